@@ -3,9 +3,12 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <exception>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -192,6 +195,152 @@ SUITE(UPDATE_AUTH) {
     cout << AuthFixture::property << endl;
     compare_json_values (expect, ret_res.second);
   }
+
+  /*
+    Tokens that cannot update the entity are rejected before
+    reaching Azure: Forbidden without update permission, NotFound
+    for another entity. Azure's own rejections are Forbidden.
+   */
+  TEST_FIXTURE(AuthFixture, PutAuthRejected) {
+    value body {build_json_object (vector<pair<string,string>> {make_pair(string("born"),string("1942"))})};
+
+    pair<status_code,string> read_token {
+      get_read_token(AuthFixture::auth_addr,
+                     AuthFixture::userid,
+                     AuthFixture::user_pwd)};
+    CHECK_EQUAL (status_codes::OK, read_token.first);
+
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(AuthFixture::addr)
+                  + update_entity_auth + "/"
+                  + AuthFixture::table + "/"
+                  + read_token.second + "/"
+                  + AuthFixture::partition + "/"
+                  + AuthFixture::row,
+                  body)};
+    CHECK_EQUAL(status_codes::Forbidden, result.first);
+
+    pair<status_code,string> update_token {
+      get_update_token(AuthFixture::auth_addr,
+                       AuthFixture::userid,
+                       AuthFixture::user_pwd)};
+    CHECK_EQUAL (status_codes::OK, update_token.first);
+
+    result = do_request (methods::PUT,
+                         string(AuthFixture::addr)
+                         + update_entity_auth + "/"
+                         + AuthFixture::table + "/"
+                         + update_token.second + "/"
+                         + "WrongPartition" + "/"
+                         + AuthFixture::row,
+                         body);
+    CHECK_EQUAL(status_codes::NotFound, result.first);
+
+    // A token that passes the local checks but that Azure rejects,
+    // here for its signature, stays Forbidden
+    string forged {update_token.second};
+    const string::size_type sig {forged.find("sig=")};
+    CHECK(sig != string::npos);
+    if (sig != string::npos) {
+      forged.insert(sig + 4, "AAAA");
+      result = do_request (methods::PUT,
+                           string(AuthFixture::addr)
+                           + update_entity_auth + "/"
+                           + AuthFixture::table + "/"
+                           + forged + "/"
+                           + AuthFixture::partition + "/"
+                           + AuthFixture::row,
+                           body);
+      CHECK_EQUAL(status_codes::Forbidden, result.first);
+    }
+
+    // A token whose permissions would come from a stored access
+    // policy cannot be checked locally, so Azure decides
+    result = do_request (methods::PUT,
+                         string(AuthFixture::addr)
+                         + update_entity_auth + "/"
+                         + AuthFixture::table + "/"
+                         + "si=NoSuchPolicy&tn=" + AuthFixture::table + "&sig=AAAA" + "/"
+                         + AuthFixture::partition + "/"
+                         + AuthFixture::row,
+                         body);
+    CHECK_EQUAL(status_codes::Forbidden, result.first);
+  }
+
+  /*
+    List items are appended and removed in place, leaving the
+    other elements of the list as they were.
+   */
+  TEST_FIXTURE(AuthFixture, EditListAuth) {
+    pair<status_code,string> token_res {
+      get_update_token(AuthFixture::auth_addr,
+                       AuthFixture::userid,
+                       AuthFixture::user_pwd)};
+    CHECK_EQUAL (status_codes::OK, token_res.first);
+    const string entity_path {string(AuthFixture::table) + "/"
+                              + token_res.second + "/"
+                              + AuthFixture::partition + "/"
+                              + AuthFixture::row};
+
+    for (const string item : {"USA;Franklin,Aretha", "Canada;Edwards,Kathleen", "Korea;BigBang"}) {
+      pair<status_code,value> result {
+        do_request (methods::PUT,
+                    string(AuthFixture::addr) + append_list_item_auth + "/" + entity_path,
+                    build_json_object (vector<pair<string,string>> {make_pair(string("Friends"), item)}))};
+      CHECK_EQUAL(status_codes::OK, result.first);
+    }
+
+    // Appending an item already in the list leaves it unchanged
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(AuthFixture::addr) + append_list_item_auth + "/" + entity_path,
+                  build_json_object (vector<pair<string,string>> {
+                      make_pair(string("Friends"), string("Korea;BigBang"))}))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+
+    result = do_request (methods::PUT,
+                         string(AuthFixture::addr) + remove_list_item_auth + "/" + entity_path,
+                         build_json_object (vector<pair<string,string>> {
+                             make_pair(string("Friends"), string("Canada;Edwards,Kathleen"))}));
+    CHECK_EQUAL(status_codes::OK, result.first);
+
+    // Items containing the list separator are rejected
+    result = do_request (methods::PUT,
+                         string(AuthFixture::addr) + append_list_item_auth + "/" + entity_path,
+                         build_json_object (vector<pair<string,string>> {
+                             make_pair(string("Friends"), string("USA;A|USA;B"))}));
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
+
+    result = do_request (methods::GET,
+                         string(AuthFixture::addr)
+                         + read_entity_admin + "/"
+                         + AuthFixture::table + "/"
+                         + AuthFixture::partition + "/"
+                         + AuthFixture::row);
+    CHECK_EQUAL (status_codes::OK, result.first);
+    CHECK_EQUAL (string("USA;Franklin,Aretha|Korea;BigBang"), result.second["Friends"].as_string());
+
+    // A token that passes the local checks but that Azure rejects,
+    // here for its signature, is Forbidden, as for UpdateEntityAuth
+    string forged {token_res.second};
+    const string::size_type sig {forged.find("sig=")};
+    CHECK(sig != string::npos);
+    if (sig != string::npos) {
+      forged.insert(sig + 4, "AAAA");
+      const string forged_path {string(AuthFixture::table) + "/"
+                                + forged + "/"
+                                + AuthFixture::partition + "/"
+                                + AuthFixture::row};
+      for (const string& op : {append_list_item_auth, remove_list_item_auth}) {
+        result = do_request (methods::PUT,
+                             string(AuthFixture::addr) + op + "/" + forged_path,
+                             build_json_object (vector<pair<string,string>> {
+                                 make_pair(string("Friends"), string("Korea;BigBang"))}));
+        CHECK_EQUAL(status_codes::Forbidden, result.first);
+      }
+    }
+  }
 }
 
 SUITE(GET_READ_TOKEN){
@@ -393,6 +542,174 @@ SUITE(GET_UPDATE_DATA){
   }
 }
 
+SUITE(GET_UPDATE_DATA_BULK){
+  TEST_FIXTURE(AuthFixture, GetUpdateDataBulk){
+    pair<status_code, value> result;
+    vector<pair<string,value>> passwords;
+
+    //one good user, one unknown user
+    passwords.push_back( make_pair( string(AuthFixture::userid), value::string(user_pwd) ) );
+    passwords.push_back( make_pair( "WrongUser", value::string(user_pwd) ) );
+    result = do_request( methods::GET,
+      string(AuthFixture::auth_addr)
+      + get_update_data_bulk_op,
+      value::object(passwords) );
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(2, result.second.size());
+    value user {result.second[AuthFixture::userid]};
+    CHECK_EQUAL(status_codes::OK, user["Status"].as_integer());
+    CHECK_EQUAL(string(AuthFixture::partition), user["DataPartition"].as_string());
+    CHECK_EQUAL(string(AuthFixture::row), user["DataRow"].as_string());
+    CHECK_EQUAL(status_codes::NotFound, result.second["WrongUser"]["Status"].as_integer());
+    passwords.clear();
+
+    //wrong password, not found for that user only
+    passwords.push_back( make_pair( string(AuthFixture::userid), value::string("WrongPassword") ) );
+    result = do_request( methods::GET,
+      string(AuthFixture::auth_addr)
+      + get_update_data_bulk_op,
+      value::object(passwords) );
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(status_codes::NotFound, result.second[AuthFixture::userid]["Status"].as_integer());
+    passwords.clear();
+
+    //more users than fit in one AuthTable query, so read in several batches
+    passwords.push_back( make_pair( string(AuthFixture::userid), value::string(user_pwd) ) );
+    for (int i {0}; i < 40; ++i) {
+      passwords.push_back( make_pair( "WrongUser" + std::to_string(i), value::string(user_pwd) ) );
+    }
+    result = do_request( methods::GET,
+      string(AuthFixture::auth_addr)
+      + get_update_data_bulk_op,
+      value::object(passwords) );
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(41, result.second.size());
+    CHECK_EQUAL(status_codes::OK, result.second[AuthFixture::userid]["Status"].as_integer());
+    CHECK_EQUAL(status_codes::NotFound, result.second["WrongUser39"]["Status"].as_integer());
+    passwords.clear();
+
+    //no users, badrequest
+    result = do_request( methods::GET,
+      string(AuthFixture::auth_addr)
+      + get_update_data_bulk_op,
+      value::object(passwords) );
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
+  }
+}
+
+SUITE(CREDENTIAL_CACHE){
+  /*
+    A password changed in AuthTable takes effect as soon as
+    InvalidateCredentialsAdmin is called for the user, even though
+    the old entry is still cached.
+   */
+  TEST_FIXTURE(AuthFixture, InvalidateCredentials){
+    const string new_pwd {"NewPassword"};
+    // Cache the user's credentials
+    CHECK_EQUAL(status_codes::OK,
+                get_update_token(AuthFixture::auth_addr, AuthFixture::userid, AuthFixture::user_pwd).first);
+
+    vector<pair<string, value>> properties;
+    properties.push_back( make_pair(string(AuthFixture::auth_pwd_prop), value::string(new_pwd)) );
+    properties.push_back( make_pair("DataPartition", value::string(AuthFixture::partition)) );
+    properties.push_back( make_pair("DataRow", value::string(AuthFixture::row)) );
+    CHECK_EQUAL(status_codes::OK,
+                put_entity(AuthFixture::addr, AuthFixture::auth_table,
+                           AuthFixture::auth_table_partition, AuthFixture::userid, properties));
+
+    pair<status_code,value> result {
+      do_request (methods::DEL,
+                  string(AuthFixture::auth_addr)
+                  + invalidate_credentials_op + "/"
+                  + AuthFixture::userid)};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(status_codes::OK,
+                get_update_token(AuthFixture::auth_addr, AuthFixture::userid, new_pwd).first);
+    CHECK_EQUAL(status_codes::NotFound,
+                get_update_token(AuthFixture::auth_addr, AuthFixture::userid, AuthFixture::user_pwd).first);
+
+    // Restore the password, and drop the new one from the cache so
+    // that later tests see the fixture's password at once
+    properties[0].second = value::string(AuthFixture::user_pwd);
+    CHECK_EQUAL(status_codes::OK,
+                put_entity(AuthFixture::addr, AuthFixture::auth_table,
+                           AuthFixture::auth_table_partition, AuthFixture::userid, properties));
+    result = do_request (methods::DEL,
+                         string(AuthFixture::auth_addr)
+                         + invalidate_credentials_op + "/"
+                         + AuthFixture::userid);
+    CHECK_EQUAL(status_codes::OK, result.first);
+  }
+
+  /*
+    Sign-on storm benchmark: many threads requesting update data for
+    a set of users at once, as when clients reconnect after an outage.
+    Each user's first request misses the credential cache and later
+    ones hit it. Reports the request rate and the latency
+    percentiles; AuthServer reports the cache hit rate when it stops.
+   */
+  TEST_FIXTURE(AuthFixture, SignOnStormBenchmark){
+    const int user_count {50};
+    const int thread_count {8};
+    const int requests_per_thread {100};
+
+    vector<pair<string, value>> properties;
+    properties.push_back( make_pair(string(AuthFixture::auth_pwd_prop), value::string(AuthFixture::user_pwd)) );
+    properties.push_back( make_pair("DataPartition", value::string(AuthFixture::partition)) );
+    properties.push_back( make_pair("DataRow", value::string(AuthFixture::row)) );
+    vector<string> userids {};
+    for (int u {0}; u < user_count; ++u) {
+      userids.push_back("StormUser" + std::to_string(u));
+      CHECK_EQUAL(status_codes::OK,
+                  put_entity(AuthFixture::addr, AuthFixture::auth_table,
+                             AuthFixture::auth_table_partition, userids.back(), properties));
+    }
+
+    const value password {build_json_object (vector<pair<string,string>> {
+        make_pair(string(AuthFixture::auth_pwd_prop), string(AuthFixture::user_pwd))})};
+    std::atomic<int> failures {0};
+    vector<vector<double>> latencies (thread_count);
+    const auto start = std::chrono::steady_clock::now();
+    vector<std::thread> threads {};
+    for (int t {0}; t < thread_count; ++t) {
+      threads.push_back(std::thread {[&userids, &password, &failures, &latencies, t, thread_count, requests_per_thread] ()
+        {
+          for (int i {0}; i < requests_per_thread; ++i) {
+            const string& userid (userids[(i * thread_count + t) % userids.size()]);
+            const auto sent = std::chrono::steady_clock::now();
+            pair<status_code,value> result {
+              do_request (methods::GET,
+                          string(AuthFixture::auth_addr) + get_update_data_op + "/" + userid,
+                          password)};
+            const std::chrono::duration<double, std::milli> latency {std::chrono::steady_clock::now() - sent};
+            latencies[t].push_back(latency.count());
+            if (result.first != status_codes::OK)
+              ++failures;
+          }
+        }});
+    }
+    for (auto& thread : threads)
+      thread.join();
+    const std::chrono::duration<double> elapsed {std::chrono::steady_clock::now() - start};
+
+    vector<double> all {};
+    for (const auto& thread_latencies : latencies)
+      all.insert(all.end(), thread_latencies.begin(), thread_latencies.end());
+    std::sort(all.begin(), all.end());
+    cout << "Sign-on storm: " << all.size() << " requests for " << user_count << " users in "
+         << elapsed.count() << " s (" << all.size() / elapsed.count() << " per second), latency p50 "
+         << all[all.size() / 2] << " ms, p99 " << all[all.size() * 99 / 100] << " ms, max "
+         << all.back() << " ms" << endl;
+    CHECK_EQUAL(0, failures.load());
+
+    for (const auto& userid : userids) {
+      CHECK_EQUAL(status_codes::OK,
+                  delete_entity(AuthFixture::addr, AuthFixture::auth_table,
+                                AuthFixture::auth_table_partition, userid));
+    }
+  }
+}
+
 SUITE(GET_AUTH){
     // Test Fixture for Get Auth
     TEST_FIXTURE(AuthFixture, GetAuth){
@@ -298,6 +298,17 @@ SUITE(GET) {
     CHECK_EQUAL(status_codes::OK, result.first);
     CHECK(result.second.is_array());
     CHECK_EQUAL(1, result.second.as_array().size());
+    // Only the requested property is returned, along with Partition and Row
+    compare_json_arrays(
+      vector<object> {
+        value::object(vector<pair<string,value>> {
+          make_pair(string("Partition"), value::string(p3_partition)),
+          make_pair(string("Row"), value::string(p3_row)),
+          make_pair(p3_property, value::string(p3_prop_val))
+        }).as_object()
+      },
+      result.second
+    );
 
     // Proper request
     // Uses 2 properties to request the 1 entity:
@@ -493,6 +504,188 @@ SUITE(GET) {
     CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, partition, row));
   }
 
+  /*
+    A test of GET all table entries one page at a time
+
+    URI: http://localhost:34568/ReadEntityAdmin/TableName?pagesize=N
+    Further pages add &continuation=TOKEN, where TOKEN is the value of the
+    Continuation-Token header of the previous page.
+   */
+  TEST_FIXTURE(BasicFixture, GetAllPaged) {
+    string partition {"Canada"};
+    string row {"Katherines,The"};
+    string property {"Home"};
+    string prop_val {"Vancouver"};
+    int put_result {put_entity (BasicFixture::addr, BasicFixture::table, partition, row, property, prop_val)};
+    cerr << "put result " << put_result << endl;
+    assert (put_result == status_codes::OK);
+
+    // Read the two entities one per page, following the continuation
+    http_client client {string(BasicFixture::addr)};
+    string base {read_entity_admin + "/" + BasicFixture::table + "?pagesize=1"};
+    string continuation {};
+    size_t total {0};
+    int pages {0};
+    do {
+      http_response response {
+        client.request(methods::GET,
+                       continuation.empty() ? base : base + "&continuation=" + continuation).get()
+      };
+      CHECK_EQUAL(status_codes::OK, response.status_code());
+      value body {response.extract_json().get()};
+      CHECK(body.is_array());
+      CHECK(body.as_array().size() <= 1);
+      total += body.as_array().size();
+
+      const http_headers& headers {response.headers()};
+      auto header (headers.find("Continuation-Token"));
+      continuation = header == headers.end() ? string {} : header->second;
+      ++pages;
+    } while ( ! continuation.empty() && pages < 10);
+    CHECK_EQUAL(2, total);
+
+    // Invalid page sizes and tokens
+    pair<status_code,value> result {
+      do_request (methods::GET,
+                  string(BasicFixture::addr)
+                  + read_entity_admin + "/"
+                  + BasicFixture::table + "?pagesize=0")};
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
+
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entity_admin + "/"
+                         + BasicFixture::table + "?pagesize=1&continuation=xyz");
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
+
+    // A well-formed token that Azure does not recognize is a client error
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entity_admin + "/"
+                         + BasicFixture::table + "?pagesize=1&continuation="
+                         + "4e657874506172746974696f6e4b65793d3121626f677573"
+                         + "264e657874526f774b65793d3121626f677573");
+    CHECK(result.first != status_codes::InternalError);
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, partition, row));
+  }
+
+  /*
+    A test of GET of many entities by their keys
+
+    URI: http://localhost:34568/ReadEntitiesAdmin/TableName
+    Body (JSON array): One object per entity, with "Partition" and "Row".
+   */
+  TEST_FIXTURE(BasicFixture, GetEntities) {
+    string partition {"Canada"};
+    string row {"Katherines,The"};
+    string property {"Home"};
+    string prop_val {"Vancouver"};
+    int put_result {put_entity (BasicFixture::addr, BasicFixture::table, partition, row, property, prop_val)};
+    cerr << "put result " << put_result << endl;
+    assert (put_result == status_codes::OK);
+
+    auto key = [] (const string& partition, const string& row) {
+      return value::object(vector<pair<string,value>> {
+          make_pair(string("Partition"), value::string(partition)),
+          make_pair(string("Row"), value::string(row))
+      });
+    };
+    vector<value> keys {
+      key(BasicFixture::partition, BasicFixture::row),
+      key("NonexistentPartition", "NonexistentRow"),
+      key(partition, row)
+    };
+
+    pair<status_code,value> result {
+      do_request (methods::GET,
+                  string(BasicFixture::addr)
+                  + read_entities_admin + "/"
+                  + BasicFixture::table,
+                  value::array(keys))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK(result.second.is_array());
+    CHECK_EQUAL(3, result.second.as_array().size());
+    if (result.second.is_array() && result.second.as_array().size() == 3) {
+      value first {result.second.as_array().at(0)};
+      CHECK_EQUAL(status_codes::OK, first.at("Status").as_integer());
+      CHECK_EQUAL(string(BasicFixture::row), first.at("Row").as_string());
+      CHECK_EQUAL(string(BasicFixture::prop_val),
+                  first.at("Entity").at(BasicFixture::property).as_string());
+
+      CHECK_EQUAL(status_codes::NotFound, result.second.as_array().at(1).at("Status").as_integer());
+      CHECK(! result.second.as_array().at(1).has_field("Entity"));
+
+      value third {result.second.as_array().at(2)};
+      CHECK_EQUAL(status_codes::OK, third.at("Status").as_integer());
+      CHECK_EQUAL(prop_val, third.at("Entity").at(property).as_string());
+    }
+
+    // Body is not an array
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entities_admin + "/"
+                         + BasicFixture::table,
+                         key(partition, row));
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
+
+    // Table does not exist
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entities_admin + "/"
+                         + "NonexistentTable",
+                         value::array(keys));
+    CHECK_EQUAL(status_codes::NotFound, result.first);
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, partition, row));
+  }
+
+  /*
+    Point reads and ReadEntitiesAdmin write entities as JSON text
+    directly, so check that characters needing escapes survive both.
+   */
+  TEST_FIXTURE(BasicFixture, GetEscaped) {
+    string partition {"Canada"};
+    string row {"Quote,The"};
+    string property {"Line"};
+    string prop_val {"She said \"go\\stop\"\ttwice"};
+    int put_result {put_entity (BasicFixture::addr, BasicFixture::table, partition, row, property, prop_val)};
+    CHECK_EQUAL(status_codes::OK, put_result);
+
+    pair<status_code,value> result {
+      do_request (methods::GET,
+                  string(BasicFixture::addr)
+                  + read_entity_admin + "/"
+                  + BasicFixture::table + "/"
+                  + partition + "/"
+                  + row)};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK(result.second.is_object() && result.second.has_field(property));
+    if (result.second.is_object() && result.second.has_field(property))
+      CHECK_EQUAL(prop_val, result.second.at(property).as_string());
+
+    vector<value> keys {
+      value::object(vector<pair<string,value>> {
+          make_pair(string("Partition"), value::string(partition)),
+          make_pair(string("Row"), value::string(row))
+      })
+    };
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entities_admin + "/"
+                         + BasicFixture::table,
+                         value::array(keys));
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK(result.second.is_array() && result.second.as_array().size() == 1);
+    if (result.second.is_array() && result.second.as_array().size() == 1) {
+      value entity {result.second.as_array().at(0)};
+      CHECK_EQUAL(row, entity.at("Row").as_string());
+      CHECK_EQUAL(prop_val, entity.at("Entity").at(property).as_string());
+    }
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, partition, row));
+  }
+
   /*
     A test of GET all entities from a specific partition
   */
@@ -560,3 +753,172 @@ SUITE(GET) {
     //CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, partition, row) );
   }
 };
+
+SUITE(PUT) {
+  /*
+    A test of updating many entities in one request
+
+    URI: http://localhost:34568/UpdateEntitiesAdmin/TableName
+    Body (JSON array): One object per entity, with "Partition" and "Row"
+      naming the entity and the properties to set.
+   */
+  TEST_FIXTURE(BasicFixture, PutEntities) {
+    auto entity = [] (const string& partition, const string& row, const string& home) {
+      return value::object(vector<pair<string,value>> {
+          make_pair(string("Partition"), value::string(partition)),
+          make_pair(string("Row"), value::string(row)),
+          make_pair(string("Home"), value::string(home))
+      });
+    };
+    vector<value> entities {
+      entity("Canada", "Katherines,The", "Vancouver"),
+      entity("Canada", "Edwards,Kathleen", "Ottawa"),
+      entity(BasicFixture::partition, BasicFixture::row, "Memphis"),
+      // Missing row name
+      value::object(vector<pair<string,value>> {
+          make_pair(string("Partition"), value::string("Canada"))
+      })
+    };
+
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(BasicFixture::addr)
+                  + update_entities_admin + "/"
+                  + BasicFixture::table,
+                  value::array(entities))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK(result.second.is_array());
+    CHECK_EQUAL(4, result.second.as_array().size());
+    if (result.second.is_array() && result.second.as_array().size() == 4) {
+      for (int i {0}; i < 3; ++i)
+        CHECK_EQUAL(status_codes::OK, result.second.as_array().at(i).at("Status").as_integer());
+      CHECK_EQUAL(status_codes::BadRequest, result.second.as_array().at(3).at("Status").as_integer());
+    }
+
+    // Entities were written, and existing properties were kept
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entity_admin + "/"
+                         + BasicFixture::table + "/"
+                         + BasicFixture::partition + "/"
+                         + BasicFixture::row);
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK(compare_json_values(
+      value::object(vector<pair<string,value>> {
+          make_pair(string(BasicFixture::property), value::string(BasicFixture::prop_val)),
+          make_pair(string("Home"), value::string("Memphis"))
+      }),
+      result.second));
+
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entity_admin + "/"
+                         + BasicFixture::table + "/Canada/*");
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(2, result.second.as_array().size());
+
+    // Body is not an array
+    result = do_request (methods::PUT,
+                         string(BasicFixture::addr)
+                         + update_entities_admin + "/"
+                         + BasicFixture::table,
+                         entity("Canada", "Katherines,The", "Vancouver"));
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
+
+    // Table does not exist
+    result = do_request (methods::PUT,
+                         string(BasicFixture::addr)
+                         + update_entities_admin + "/"
+                         + "NonexistentTable",
+                         value::array(entities));
+    CHECK_EQUAL(status_codes::NotFound, result.first);
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Katherines,The"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Edwards,Kathleen"));
+  }
+
+  /*
+    A test of updating the same entity twice in one request
+
+    Both elements succeed, and the entity gets the properties of both,
+    the later element's value winning where they overlap.
+   */
+  TEST_FIXTURE(BasicFixture, PutEntitiesDuplicate) {
+    auto property = [] (const string& name, const string& val) {
+      return make_pair(name, value::string(val));
+    };
+    vector<value> entities {
+      value::object(vector<pair<string,value>> {
+          property("Partition", "Canada"), property("Row", "Katherines,The"),
+          property("Home", "Vancouver"), property("Label", "Nettwerk")
+      }),
+      value::object(vector<pair<string,value>> {
+          property("Partition", "Canada"), property("Row", "Edwards,Kathleen"),
+          property("Home", "Ottawa")
+      }),
+      value::object(vector<pair<string,value>> {
+          property("Partition", "Canada"), property("Row", "Katherines,The"),
+          property("Home", "Toronto")
+      })
+    };
+
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(BasicFixture::addr)
+                  + update_entities_admin + "/"
+                  + BasicFixture::table,
+                  value::array(entities))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK(result.second.is_array());
+    CHECK_EQUAL(3, result.second.as_array().size());
+    if (result.second.is_array() && result.second.as_array().size() == 3) {
+      for (int i {0}; i < 3; ++i)
+        CHECK_EQUAL(status_codes::OK, result.second.as_array().at(i).at("Status").as_integer());
+    }
+
+    result = do_request (methods::GET,
+                         string(BasicFixture::addr)
+                         + read_entity_admin + "/"
+                         + BasicFixture::table + "/Canada/Katherines,The");
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK(compare_json_values(
+      value::object(vector<pair<string,value>> {
+          property("Home", "Toronto"), property("Label", "Nettwerk")
+      }),
+      result.second));
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Katherines,The"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Edwards,Kathleen"));
+  }
+}
+
+SUITE(DELETE) {
+  /*
+    A test of reading a table after deleting it
+
+    The server caches that a table exists, so the read before the delete
+    fills the cache and the read after it must not be answered from it.
+   */
+  TEST(DeleteThenRead) {
+    const string addr {BasicFixture::addr};
+    const string table {"DeletedTable"};
+    const string partition {"Canada"};
+    const string row {"Katherines,The"};
+    int make_result {create_table(addr, table)};
+    CHECK(make_result == status_codes::Created || make_result == status_codes::Accepted);
+    CHECK_EQUAL(status_codes::OK, put_entity (addr, table, partition, row, "Home", "Vancouver"));
+
+    pair<status_code,value> result {
+      do_request (methods::GET,
+                  addr + read_entity_admin + "/" + table + "/" + partition + "/" + row)};
+    CHECK_EQUAL(status_codes::OK, result.first);
+
+    CHECK_EQUAL(status_codes::OK, delete_table(addr, table));
+
+    result = do_request (methods::GET,
+                         addr + read_entity_admin + "/" + table + "/" + partition + "/" + row);
+    CHECK_EQUAL(status_codes::NotFound, result.first);
+    result = do_request (methods::GET, addr + read_entity_admin + "/" + table);
+    CHECK_EQUAL(status_codes::NotFound, result.first);
+  }
+}
@@ -0,0 +1,144 @@
+/*
+  This C++ file contains unit tests for the pool of HTTP clients used
+  by the user and push servers, and a benchmark of calls through it.
+  Like tester-sessionstore.cpp, it needs none of the servers: the
+  calls go to an echo listener opened by the test itself.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cpprest/base_uri.h>
+#include <cpprest/http_client.h>
+#include <cpprest/http_listener.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include "../include/HttpClientPool.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+using web::uri;
+
+using web::http::http_request;
+using web::http::methods;
+using web::http::status_codes;
+
+using web::http::client::http_client;
+
+using web::http::experimental::listener::http_listener;
+
+namespace {
+
+// Port for the echo listener; the servers use 34568 to 34572
+const string echo_url {"http://localhost:34590"};
+
+using client_source_t = std::function<std::shared_ptr<http_client> ()>;
+
+/*
+  Make calls from thread_count threads, each taking its client from
+  source for every call, and report the rate and the latency
+  percentiles under label. Returns the number of calls that failed.
+ */
+int measure_calls(const string& label, int thread_count, int calls_per_thread,
+                  client_source_t source) {
+  std::atomic<int> failures {0};
+  vector<vector<double>> latencies (thread_count);
+  const auto start = std::chrono::steady_clock::now();
+  vector<std::thread> threads {};
+  for (int t {0}; t < thread_count; ++t) {
+    threads.push_back(std::thread {[&failures, &latencies, &source, t, calls_per_thread] ()
+      {
+        for (int i {0}; i < calls_per_thread; ++i) {
+          const auto sent = std::chrono::steady_clock::now();
+          try {
+            if (source()->request(methods::GET, "/echo").get().status_code() != status_codes::OK)
+              ++failures;
+          }
+          catch (const std::exception& e) {
+            cout << e.what() << endl;
+            ++failures;
+          }
+          const std::chrono::duration<double, std::milli> latency {std::chrono::steady_clock::now() - sent};
+          latencies[t].push_back(latency.count());
+        }
+      }});
+  }
+  for (auto& thread : threads)
+    thread.join();
+  const std::chrono::duration<double> elapsed {std::chrono::steady_clock::now() - start};
+
+  vector<double> all {};
+  for (const auto& thread_latencies : latencies)
+    all.insert(all.end(), thread_latencies.begin(), thread_latencies.end());
+  std::sort(all.begin(), all.end());
+  cout << label << ": " << thread_count << " threads, "
+       << all.size() / elapsed.count() << " calls per second, latency p50 "
+       << all[all.size() / 2] << " ms, p99 " << all[all.size() * 99 / 100] << " ms" << endl;
+  return failures;
+}
+
+}
+
+SUITE(HTTP_CLIENT_POOL) {
+  /*
+    Targets on the same scheme, host and port share a client whatever
+    their paths; the least recently used client is closed when the
+    pool is full, and any client once idle too long.
+   */
+  TEST(SharesAndEvicts) {
+    HttpClientPool pool {2, std::chrono::hours {1}};
+    auto first = pool.lookup_client(uri {"http://localhost:34590/a"});
+    CHECK(first == pool.lookup_client(uri {"http://localhost:34590/b/c"}));
+    CHECK(first != pool.lookup_client(uri {"http://localhost:34591/a"}));
+    CHECK_EQUAL(1u, pool.hits());
+    CHECK_EQUAL(2u, pool.misses());
+
+    // Use 34590 again, so 34591 is the least recently used
+    pool.lookup_client(uri {"http://localhost:34590"});
+    pool.lookup_client(uri {"http://localhost:34592"});
+    CHECK(first == pool.lookup_client(uri {"http://localhost:34590"}));
+    const auto misses = pool.misses();
+    pool.lookup_client(uri {"http://localhost:34591"});
+    CHECK_EQUAL(misses + 1, pool.misses());
+
+    HttpClientPool short_lived {2, std::chrono::seconds {0}};
+    auto client = short_lived.lookup_client(uri {"http://localhost:34590"});
+    CHECK(client != short_lived.lookup_client(uri {"http://localhost:34590"}));
+  }
+
+  /*
+    Benchmark: calls per second and p50/p99 latency against a local
+    echo listener, first with a new client for every call, as before
+    the pool, then with clients taken from the pool, which keep their
+    connections open between calls.
+   */
+  TEST(PooledCallBenchmark) {
+    http_listener listener {echo_url};
+    listener.support(methods::GET, [] (http_request message) { message.reply(status_codes::OK); });
+    listener.open().wait();
+
+    const int thread_count {8};
+    const int calls_per_thread {250};
+    HttpClientPool pool {16, std::chrono::seconds {60}};
+    const uri target {echo_url};
+
+    CHECK_EQUAL(0, measure_calls("New client per call", thread_count, calls_per_thread,
+                                 [&target] () { return std::make_shared<http_client>(target); }));
+    CHECK_EQUAL(0, measure_calls("Pooled client", thread_count, calls_per_thread,
+                                 [&pool, &target] () { return pool.lookup_client(target); }));
+    cout << "Pool hits " << pool.hits() << ", misses " << pool.misses() << endl;
+
+    listener.close().wait();
+  }
+}
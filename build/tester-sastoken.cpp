@@ -0,0 +1,134 @@
+/*
+  This C++ file contains unit tests for the local checks of SAS tokens
+  made before calling Azure, and a benchmark of token signing. Like
+  tester-sessionstore.cpp, it needs no server: parsing and signing
+  are both done without contacting storage.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cpprest/asyncrt_utils.h>
+
+#include <was/storage_account.h>
+#include <was/table.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include "../include/SasToken.h"
+
+using azure::storage::cloud_storage_account;
+using azure::storage::cloud_table;
+using azure::storage::table_shared_access_policy;
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+
+// A well-formed account key of 64 zero bytes; never sent anywhere
+const string connection {
+  "DefaultEndpointsProtocol=https;AccountName=benchmark;"
+  "AccountKey=AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=="};
+
+cloud_table data_table() {
+  return cloud_storage_account::parse(connection)
+    .create_cloud_table_client()
+    .get_table_reference("DataTable");
+}
+
+// A token for the single entity (partition, row), as AuthServer signs it
+string sign_token(const cloud_table& table, const string& partition, const string& row) {
+  const utility::datetime expiry {utility::datetime::utc_now() + utility::datetime::from_hours(24)};
+  return table.get_shared_access_signature(
+    table_shared_access_policy {expiry,
+                                table_shared_access_policy::permissions::read |
+                                table_shared_access_policy::permissions::update},
+    string(), partition, row, partition, row);
+}
+
+}
+
+SUITE(SAS_TOKEN) {
+  /*
+    A token signed for one entity covers that entity only, grants
+    the permissions it was signed with, and expires in about a day.
+   */
+  TEST(SignedTokenChecks) {
+    const string token {sign_token(data_table(), "USA", "Franklin,Aretha")};
+    sas_token_t fields;
+    CHECK(parse_sas_token(token, fields));
+    CHECK(sas_checkable(fields));
+    CHECK(sas_allows(fields, 'r'));
+    CHECK(sas_allows(fields, 'u'));
+    CHECK( ! sas_allows(fields, 'd'));
+
+    const utility::datetime now {utility::datetime::utc_now()};
+    CHECK(sas_covers(fields, "datatable", "USA", "Franklin,Aretha", now));
+    CHECK( ! sas_covers(fields, "DataTable", "USA", "Franklin,Arethb", now));
+    CHECK( ! sas_covers(fields, "DataTable", "Canada", "Franklin,Aretha", now));
+    CHECK( ! sas_covers(fields, "OtherTable", "USA", "Franklin,Aretha", now));
+    CHECK( ! sas_covers(fields, "DataTable", "USA", "Franklin,Aretha",
+                        now + utility::datetime::from_hours(25)));
+
+    const auto lifetime = sas_lifetime(token, std::chrono::seconds {0});
+    CHECK(lifetime > std::chrono::hours {23});
+    CHECK(lifetime <= std::chrono::hours {24});
+  }
+
+  /*
+    A token that takes its permissions from a stored access policy
+    parses, but is left for Azure to check. One with neither
+    permissions nor a policy, or with no signature, is not a SAS.
+   */
+  TEST(PolicyTokens) {
+    sas_token_t fields;
+    CHECK(parse_sas_token("si=ReadOnly&tn=DataTable&sig=AAAA", fields));
+    CHECK( ! sas_checkable(fields));
+    CHECK(parse_sas_token("?sp=r&si=ReadOnly&tn=DataTable&sig=AAAA", fields));
+    CHECK(sas_checkable(fields));
+    CHECK( ! parse_sas_token("tn=DataTable&sig=AAAA", fields));
+    CHECK( ! parse_sas_token("sp=r&si=ReadOnly&tn=DataTable", fields));
+  }
+
+  /*
+    Benchmark: tokens signed per second, as the number of threads
+    doubles up to twice the hardware threads. This is the work the
+    issued-token cache in AuthServer saves on each repeat request.
+   */
+  TEST(SigningBenchmark) {
+    const cloud_table table {data_table()};
+    const unsigned max_threads {std::thread::hardware_concurrency() > 0 ?
+                                2 * std::thread::hardware_concurrency() : 8};
+    const int tokens_per_thread {2000};
+
+    for (unsigned thread_count {1}; thread_count <= max_threads; thread_count *= 2) {
+      std::atomic<int> failures {0};
+      const auto start = std::chrono::steady_clock::now();
+      vector<std::thread> threads {};
+      for (unsigned t {0}; t < thread_count; ++t) {
+        threads.push_back(std::thread {[&table, &failures, t, tokens_per_thread] ()
+          {
+            for (int i {0}; i < tokens_per_thread; ++i) {
+              if (sign_token(table, "Partition" + std::to_string(t), "Row" + std::to_string(i)).empty())
+                ++failures;
+            }
+          }});
+      }
+      for (auto& thread : threads)
+        thread.join();
+      const std::chrono::duration<double> elapsed {std::chrono::steady_clock::now() - start};
+
+      const double tokens {static_cast<double>(thread_count) * tokens_per_thread};
+      cout << "SAS token signing: " << thread_count << " threads, "
+           << tokens / elapsed.count() << " per second" << endl;
+      CHECK_EQUAL(0, failures.load());
+    }
+  }
+}
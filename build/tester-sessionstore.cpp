@@ -0,0 +1,268 @@
+/*
+  This C++ file contains unit tests for the session store of the
+  user server. Unlike the other testers, it calls SessionStore
+  directly, so no server needs to be running.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include "../include/SessionStore.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+
+constexpr std::chrono::hours session_ttl {1};
+
+SessionStore::session_t session_for(const string& userid, int version) {
+  return SessionStore::session_t {
+    "token-" + userid + "-" + std::to_string(version),
+    "partition-" + userid,
+    "row-" + userid};
+}
+
+const string store_path {"tester-sessions"};
+
+// Remove every file a store at store_path may have written
+void remove_store_files() {
+  for (const string& suffix : vector<string> {"", ".log", ".log.old", ".tmp"})
+    std::remove((store_path + suffix).c_str());
+}
+
+bool file_exists(const string& path) {
+  return static_cast<bool>(std::ifstream {path});
+}
+
+}
+
+SUITE(SESSION_STORE) {
+  /*
+    Threads sign users on, look them up and sign them off at once.
+    Each thread owns its users, so it can check every result; all
+    threads also share one user, whose session must always be one
+    of those written.
+   */
+  TEST(ConcurrentUse) {
+    SessionStore store {};
+    const int thread_count {8};
+    const int users_per_thread {200};
+    const string shared_user {"shared"};
+    std::atomic<int> failures {0};
+
+    vector<std::thread> threads {};
+    for (int t {0}; t < thread_count; ++t) {
+      threads.push_back(std::thread {[&store, &failures, &shared_user, t, users_per_thread] ()
+        {
+          SessionStore::session_t found;
+          for (int u {0}; u < users_per_thread; ++u) {
+            const string userid {"user" + std::to_string(t) + "-" + std::to_string(u)};
+            store.insert(userid, session_for(userid, 1), session_ttl);
+            store.insert(shared_user, session_for(shared_user, t), session_ttl);
+            if ( ! store.lookup(userid, found) ||
+                 found.token != session_for(userid, 1).token)
+              ++failures;
+            if ( ! store.lookup(shared_user, found) ||
+                 found.partition != session_for(shared_user, 0).partition)
+              ++failures;
+            // Sign off every other user
+            if (u % 2 == 1 && ! store.erase(userid))
+              ++failures;
+          }
+        }});
+    }
+    for (auto& thread : threads)
+      thread.join();
+    CHECK_EQUAL(0, failures.load());
+
+    SessionStore::session_t found;
+    for (int t {0}; t < thread_count; ++t) {
+      for (int u {0}; u < users_per_thread; ++u) {
+        const string userid {"user" + std::to_string(t) + "-" + std::to_string(u)};
+        CHECK_EQUAL(u % 2 == 0, store.lookup(userid, found));
+      }
+    }
+    CHECK(store.lookup(shared_user, found));
+  }
+
+  /*
+    Stress benchmark: many threads signing on, reading and signing
+    off distinct users as fast as they can. Reports the rate, and
+    checks only that no operation gave a wrong answer.
+   */
+  TEST(StressBenchmark) {
+    SessionStore store {};
+    const unsigned thread_count {std::thread::hardware_concurrency() > 0 ?
+                                 2 * std::thread::hardware_concurrency() : 8};
+    const int operations_per_thread {20000};
+    std::atomic<int> failures {0};
+
+    const auto start = std::chrono::steady_clock::now();
+    vector<std::thread> threads {};
+    for (unsigned t {0}; t < thread_count; ++t) {
+      threads.push_back(std::thread {[&store, &failures, t, operations_per_thread] ()
+        {
+          SessionStore::session_t found;
+          for (int i {0}; i < operations_per_thread; ++i) {
+            const string userid {"stress" + std::to_string(t) + "-" + std::to_string(i % 500)};
+            switch (i % 4) {
+              case 0:
+                store.insert(userid, session_for(userid, i), session_ttl);
+                break;
+              case 3:
+                store.erase(userid);
+                break;
+              default:
+                if (store.lookup(userid, found) &&
+                    found.partition != session_for(userid, 0).partition)
+                  ++failures;
+            }
+          }
+        }});
+    }
+    for (auto& thread : threads)
+      thread.join();
+    const std::chrono::duration<double> elapsed {std::chrono::steady_clock::now() - start};
+
+    const double operations {static_cast<double>(thread_count) * operations_per_thread};
+    cout << "SessionStore stress: " << thread_count << " threads, "
+         << operations << " operations in " << elapsed.count() << " s ("
+         << operations / elapsed.count() << " per second)" << endl;
+    CHECK_EQUAL(0, failures.load());
+  }
+
+  /*
+    A crash may leave part of a record at the end of the log. It is
+    skipped on load and cut off, so changes made after the restart
+    are not lost behind it.
+   */
+  TEST(TornLogTail) {
+    remove_store_files();
+    std::size_t loaded {0};
+    {
+      SessionStore store {};
+      CHECK(store.open(store_path, loaded));
+      CHECK_EQUAL(0u, loaded);
+      store.insert("alice", session_for("alice", 1), session_ttl);
+      store.insert("bob", session_for("bob", 1), session_ttl);
+      store.flush();
+    }
+    {
+      // The start of an insert record, as left by a crash
+      std::ofstream log {store_path + ".log", std::ios::binary | std::ios::app};
+      log.write("+\x05\x00", 3);
+    }
+    {
+      SessionStore store {};
+      CHECK(store.open(store_path, loaded));
+      CHECK_EQUAL(2u, loaded);
+      store.insert("carol", session_for("carol", 1), session_ttl);
+      store.flush();
+    }
+    SessionStore store {};
+    CHECK(store.open(store_path, loaded));
+    CHECK_EQUAL(3u, loaded);
+    SessionStore::session_t found;
+    CHECK(store.lookup("carol", found));
+    CHECK_EQUAL(session_for("carol", 1).token, found.token);
+    remove_store_files();
+  }
+
+  /*
+    A snapshot that did not complete leaves the log it replaced as
+    log.old. Its changes are loaded before those of the log, and the
+    next snapshot covers both and removes it.
+   */
+  TEST(LeftoverOldLog) {
+    remove_store_files();
+    std::size_t loaded {0};
+    {
+      SessionStore store {};
+      CHECK(store.open(store_path, loaded));
+      store.insert("alice", session_for("alice", 1), session_ttl);
+      store.insert("bob", session_for("bob", 1), session_ttl);
+      store.flush();
+    }
+    CHECK_EQUAL(0, std::rename((store_path + ".log").c_str(), (store_path + ".log.old").c_str()));
+    {
+      SessionStore store {};
+      CHECK(store.open(store_path, loaded));
+      CHECK_EQUAL(2u, loaded);
+      store.insert("alice", session_for("alice", 2), session_ttl);
+      store.erase("bob");
+      store.flush();
+    }
+    {
+      SessionStore store {};
+      CHECK(store.open(store_path, loaded));
+      CHECK_EQUAL(1u, loaded);
+      SessionStore::session_t found;
+      CHECK(store.lookup("alice", found));
+      CHECK_EQUAL(session_for("alice", 2).token, found.token);
+      CHECK(store.snapshot());
+      CHECK( ! file_exists(store_path + ".log.old"));
+    }
+    SessionStore store {};
+    CHECK(store.open(store_path, loaded));
+    CHECK_EQUAL(1u, loaded);
+    remove_store_files();
+  }
+
+  /*
+    Sessions survive a snapshot and a reload, along with changes made
+    after the snapshot; expired sessions are dropped. The files are
+    readable by their owner only.
+   */
+  TEST(SnapshotThenReload) {
+    remove_store_files();
+    std::size_t loaded {0};
+    {
+      SessionStore store {};
+      CHECK(store.open(store_path, loaded));
+      for (int u {0}; u < 100; ++u) {
+        const string userid {"user" + std::to_string(u)};
+        store.insert(userid, session_for(userid, 1), session_ttl);
+      }
+      store.erase("user0");
+      store.insert("expired", session_for("expired", 1), std::chrono::seconds {0});
+      CHECK(store.snapshot());
+      store.insert("user1", session_for("user1", 2), session_ttl);
+      store.insert("late", session_for("late", 1), session_ttl);
+      store.flush();
+    }
+
+    for (const string& suffix : vector<string> {"", ".log"}) {
+      struct stat info;
+      CHECK_EQUAL(0, ::stat((store_path + suffix).c_str(), &info));
+      CHECK_EQUAL(static_cast<unsigned>(S_IRUSR | S_IWUSR),
+                  static_cast<unsigned>(info.st_mode & 0777));
+    }
+
+    SessionStore store {};
+    CHECK(store.open(store_path, loaded));
+    CHECK_EQUAL(100u, loaded);
+    SessionStore::session_t found;
+    CHECK( ! store.lookup("user0", found));
+    CHECK( ! store.lookup("expired", found));
+    CHECK(store.lookup("user1", found));
+    CHECK_EQUAL(session_for("user1", 2).token, found.token);
+    CHECK(store.lookup("user99", found));
+    CHECK_EQUAL(session_for("user99", 1).row, found.row);
+    CHECK(store.lookup("late", found));
+    remove_store_files();
+  }
+}
@@ -0,0 +1,120 @@
+/*
+  This C++ file contains unit tests for the table cache shared by the
+  basic and authorization servers. Like tester-sessionstore.cpp, it
+  calls TableCache directly; lookup_table() and delete_entry() make
+  no storage calls, so no server or storage account is needed.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <UnitTest++/UnitTest++.h>
+
+#include "../include/TableCache.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Parsed locally; never contacted by these tests
+const string connection {"UseDevelopmentStorage=true"};
+
+vector<string> table_names(int count) {
+  vector<string> names {};
+  for (int t {0}; t < count; ++t)
+    names.push_back("Table" + std::to_string(t));
+  return names;
+}
+
+}
+
+SUITE(TABLE_CACHE) {
+  /*
+    Threads look tables up while another thread keeps forgetting
+    them. Every lookup must return the table asked for, whether it
+    comes from a thread's current copy, a newly published one or the
+    locked path.
+   */
+  TEST(LookupsDuringDeletes) {
+    TableCache cache {};
+    cache.init(connection);
+    const vector<string> names {table_names(16)};
+    const int thread_count {8};
+    const int lookups_per_thread {50000};
+    std::atomic<int> failures {0};
+    std::atomic<bool> done {false};
+
+    std::thread deleter {[&cache, &names, &done] ()
+      {
+        while ( ! done) {
+          for (const auto& name : names)
+            cache.delete_entry(name);
+        }
+      }};
+
+    vector<std::thread> threads {};
+    for (int t {0}; t < thread_count; ++t) {
+      threads.push_back(std::thread {[&cache, &names, &failures, t, lookups_per_thread] ()
+        {
+          for (int i {0}; i < lookups_per_thread; ++i) {
+            const string& name (names[(i + t) % names.size()]);
+            if (cache.lookup_table(name).name() != name)
+              ++failures;
+          }
+        }});
+    }
+    for (auto& thread : threads)
+      thread.join();
+    done = true;
+    deleter.join();
+    CHECK_EQUAL(0, failures.load());
+  }
+
+  /*
+    Benchmark: lookups per second of tables already in the cache, as
+    the number of threads doubles up to twice the hardware threads.
+    With no lock on the read path the rate should grow with the
+    thread count until the cores run out.
+   */
+  TEST(LookupBenchmark) {
+    TableCache cache {};
+    cache.init(connection);
+    const vector<string> names {table_names(16)};
+    for (const auto& name : names)
+      cache.lookup_table(name);
+    const unsigned max_threads {std::thread::hardware_concurrency() > 0 ?
+                                2 * std::thread::hardware_concurrency() : 8};
+    const int lookups_per_thread {200000};
+
+    for (unsigned thread_count {1}; thread_count <= max_threads; thread_count *= 2) {
+      std::atomic<int> failures {0};
+      const auto start = std::chrono::steady_clock::now();
+      vector<std::thread> threads {};
+      for (unsigned t {0}; t < thread_count; ++t) {
+        threads.push_back(std::thread {[&cache, &names, &failures, t, lookups_per_thread] ()
+          {
+            for (int i {0}; i < lookups_per_thread; ++i) {
+              const string& name (names[(i + t) % names.size()]);
+              if (cache.lookup_table(name).name() != name)
+                ++failures;
+            }
+          }});
+      }
+      for (auto& thread : threads)
+        thread.join();
+      const std::chrono::duration<double> elapsed {std::chrono::steady_clock::now() - start};
+
+      const double lookups {static_cast<double>(thread_count) * lookups_per_thread};
+      cout << "TableCache lookups: " << thread_count << " threads, "
+           << lookups / elapsed.count() << " per second" << endl;
+      CHECK_EQUAL(0, failures.load());
+    }
+  }
+}
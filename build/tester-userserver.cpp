@@ -3,7 +3,9 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <utility>
@@ -526,3 +528,172 @@ SUITE(USERSERVER_POST) {
 		CHECK_EQUAL(status_codes::NotFound, result.first);
 	}
 }
+
+SUITE(USERSERVER_GET) {
+	/*
+	  ReadFriendList returns the signed-on user's friends list,
+	  read through BasicServer with the user's token.
+	 */
+	TEST_FIXTURE(UserFixture, ReadFriendList) {
+		vector<pair<string, value>> password_json;
+		pair<status_code, value> result;
+
+		// Not signed on
+		result = do_request(
+			methods::GET,
+			string(UserFixture::user_addr) +
+			read_friend_list + "/" +
+			UserFixture::userid
+		);
+		CHECK_EQUAL(status_codes::Forbidden, result.first);
+
+		// SignOn (setup)
+		password_json.push_back( make_pair(
+			string(auth_pwd_prop),
+			value::string(user_pwd)
+		));
+		result = do_request(
+			methods::POST,
+			string(UserFixture::user_addr) +
+			sign_on + "/" +
+			UserFixture::userid,
+			value::object(password_json)
+		);
+		assert(result.first == status_codes::OK);
+		password_json.clear();
+
+		// Proper request
+		result = do_request(
+			methods::GET,
+			string(UserFixture::user_addr) +
+			read_friend_list + "/" +
+			UserFixture::userid
+		);
+		CHECK_EQUAL(status_codes::OK, result.first);
+		CHECK(result.second.is_array() && result.second.as_array().size() == 1);
+		if (result.second.is_array() && result.second.as_array().size() == 1) {
+			CHECK_EQUAL(string(UserFixture::friends_val),
+			            result.second.as_array().at(0).at(UserFixture::friends).as_string());
+		}
+
+		// SignOff (cleanup)
+		result = do_request(
+			methods::POST,
+			string(UserFixture::user_addr) +
+			sign_off + "/" +
+			UserFixture::userid
+		);
+		assert(result.first == status_codes::OK);
+	}
+
+	/*
+	  Friends lists are parsed by UserServer: duplicates are dropped,
+	  keeping the first, as is a leading separator, and the order is
+	  kept. A list with a malformed pair cannot be read.
+	 */
+	TEST_FIXTURE(UserFixture, ReadFriendListParsing) {
+		vector<pair<string, value>> password_json;
+		pair<status_code, value> result;
+
+		// SignOn (setup)
+		password_json.push_back( make_pair(
+			string(auth_pwd_prop),
+			value::string(user_pwd)
+		));
+		result = do_request(
+			methods::POST,
+			string(UserFixture::user_addr) +
+			sign_on + "/" +
+			UserFixture::userid,
+			value::object(password_json)
+		);
+		assert(result.first == status_codes::OK);
+
+		// Leading separator and a duplicate
+		CHECK_EQUAL(status_codes::OK, put_entity(
+			UserFixture::basic_addr, UserFixture::table,
+			UserFixture::partition, UserFixture::row, UserFixture::friends,
+			"|Korea;Bae,Doona|USA;Shinoda,Mike|Korea;Bae,Doona|Canada;Edwards,Kathleen"));
+		result = do_request(
+			methods::GET,
+			string(UserFixture::user_addr) +
+			read_friend_list + "/" +
+			UserFixture::userid
+		);
+		CHECK_EQUAL(status_codes::OK, result.first);
+		if (result.second.is_array() && result.second.as_array().size() == 1) {
+			CHECK_EQUAL(string("Korea;Bae,Doona|USA;Shinoda,Mike|Canada;Edwards,Kathleen"),
+			            result.second.as_array().at(0).at(UserFixture::friends).as_string());
+		}
+		else {
+			CHECK(false);
+		}
+
+		// A pair with no name
+		CHECK_EQUAL(status_codes::OK, put_entity(
+			UserFixture::basic_addr, UserFixture::table,
+			UserFixture::partition, UserFixture::row, UserFixture::friends,
+			"USA;|Korea;Bae,Doona"));
+		result = do_request(
+			methods::GET,
+			string(UserFixture::user_addr) +
+			read_friend_list + "/" +
+			UserFixture::userid
+		);
+		CHECK_EQUAL(status_codes::InternalError, result.first);
+
+		// SignOff (cleanup)
+		result = do_request(
+			methods::POST,
+			string(UserFixture::user_addr) +
+			sign_off + "/" +
+			UserFixture::userid
+		);
+		assert(result.first == status_codes::OK);
+	}
+
+	/*
+	  Benchmark: end-to-end latency of sign-on, friend list read and
+	  sign-off as a client sees them, each repeated rounds times. Each
+	  of these calls crosses from UserServer to AuthServer or
+	  BasicServer, so running the tester once against the four
+	  separate servers and once against combinedserver compares
+	  loopback HTTP with in-process dispatch for those hops.
+	 */
+	TEST_FIXTURE(UserFixture, EndToEndLatencyBenchmark) {
+		const int rounds {200};
+		const value password {build_json_object (vector<pair<string,string>> {
+			make_pair(string(auth_pwd_prop), string(user_pwd))})};
+		const vector<std::function<pair<status_code,value> ()>> calls {
+			[&password] () { return do_request(methods::POST,
+			                                   string(UserFixture::user_addr) + sign_on + "/" + UserFixture::userid,
+			                                   password); },
+			[] () { return do_request(methods::GET,
+			                          string(UserFixture::user_addr) + read_friend_list + "/" + UserFixture::userid); },
+			[] () { return do_request(methods::POST,
+			                          string(UserFixture::user_addr) + sign_off + "/" + UserFixture::userid); }
+		};
+		vector<vector<double>> latencies (calls.size());
+		int failures {0};
+
+		for (int i {0}; i < rounds; ++i) {
+			for (size_t c {0}; c < calls.size(); ++c) {
+				const auto sent = std::chrono::steady_clock::now();
+				const pair<status_code,value> result {calls[c]()};
+				const std::chrono::duration<double, std::milli> latency {std::chrono::steady_clock::now() - sent};
+				latencies[c].push_back(latency.count());
+				if (result.first != status_codes::OK)
+					++failures;
+			}
+		}
+
+		const vector<string> labels {sign_on, read_friend_list, sign_off};
+		for (size_t c {0}; c < labels.size(); ++c) {
+			std::sort(latencies[c].begin(), latencies[c].end());
+			cout << labels[c] << " end to end: " << rounds << " calls, latency p50 "
+			     << latencies[c][rounds / 2] << " ms, p99 "
+			     << latencies[c][rounds * 99 / 100] << " ms" << endl;
+		}
+		CHECK_EQUAL(0, failures);
+	}
+}
@@ -45,15 +45,21 @@ const string create_table_op {"CreateTableAdmin"};
 const string delete_table_op {"DeleteTableAdmin"};
 
 const string read_entity_admin {"ReadEntityAdmin"};
+const string read_entities_admin {"ReadEntitiesAdmin"};
 const string update_entity_admin {"UpdateEntityAdmin"};
+const string update_entities_admin {"UpdateEntitiesAdmin"};
 const string delete_entity_admin {"DeleteEntityAdmin"};
 
 const string read_entity_auth {"ReadEntityAuth"};
 const string update_entity_auth {"UpdateEntityAuth"};
+const string append_list_item_auth {"AppendListItemAuth"};
+const string remove_list_item_auth {"RemoveListItemAuth"};
 
 const string get_read_token_op  {"GetReadToken"};
 const string get_update_token_op {"GetUpdateToken"};
 const string get_update_data_op {"GetUpdateData"};
+const string get_update_data_bulk_op {"GetUpdateDataBulk"};
+const string invalidate_credentials_op {"InvalidateCredentialsAdmin"};
 
 // The two optional operations from Assignment 1
 const string add_property_admin {"AddPropertyAdmin"};
@@ -1,6 +1,7 @@
 #ifndef CLIENT_UTILS_H
 #define CLIENT_UTILS_H
 
+#include <functional>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -9,6 +10,13 @@
 #include <cpprest/http_client.h>
 #include <cpprest/json.h>
 
+#include <pplx/pplxtasks.h>
+
+#include "HttpClientPool.h"
+
+// Clients shared by do_request(), one per server
+extern HttpClientPool http_client_pool;
+
 // Alias for a type representing the result of do_request()
 using req_res_t = std::pair<web::http::status_code,web::json::value>;
 
@@ -18,6 +26,31 @@ using friends_list_t = std::vector<std::pair<std::string,std::string>>;
 // Alias for an unordered_map representing a JSON object's property/value pairs
 using value_string_t = std::unordered_map<std::string,std::string>;
 
+/*
+  Host the server at base_url (scheme, host and port) in this process:
+  requests to it are passed straight to dispatch, not sent over HTTP.
+  The bodies are still JSON text, serialized and parsed as over HTTP.
+  Add every local service before making any requests.
+ */
+void
+add_local_service (const std::string& base_url, std::function<void (web::http::http_request)> dispatch);
+
+pplx::task<req_res_t>
+do_request_async (const web::http::method& http_method, const std::string& uri_string, const web::json::value& req_body);
+
+pplx::task<req_res_t>
+do_request_async (const web::http::method& http_method, const std::string& uri_string);
+
+pplx::task<req_res_t>
+then_if_ok (pplx::task<req_res_t> first,
+            std::function<pplx::task<req_res_t> (const req_res_t&)> next);
+
+pplx::task<req_res_t>
+when_all_ok (const std::vector<pplx::task<req_res_t>>& requests);
+
+bool
+get_request_result (pplx::task<req_res_t> request, web::http::http_request message, req_res_t& result);
+
 req_res_t
 do_request (const web::http::method& http_method, const std::string& uri_string, const web::json::value& req_body);
 
@@ -0,0 +1,37 @@
+#ifndef CpprestInternals_h
+#define CpprestInternals_h
+
+#include <chrono>
+
+#include <cpprest/http_msg.h>
+
+#include <pplx/pplxtasks.h>
+
+/*
+  Calls that need parts of cpprest outside its public interface.
+
+  Everything here depends on how the cpprest release in use works
+  inside, so it is kept in this one module: if an upgrade changes
+  those internals, only CpprestInternals.cpp needs to follow.
+ */
+
+/*
+  Return a task that completes once delay has passed.
+
+  pplx has no timer of its own, so this waits on an asio timer on the
+  io_service of cpprest's shared thread pool; no thread is blocked
+  meanwhile.
+ */
+pplx::task<void> after_delay (std::chrono::milliseconds delay);
+
+/*
+  Mark the body of request, built by this process, as fully received,
+  as a listener does once a body has arrived. Until then extract_json()
+  and the other extract functions wait.
+
+  cpprest has no public call for this; it uses
+  http_msg_base::_complete().
+ */
+void mark_body_received (web::http::http_request request);
+
+#endif
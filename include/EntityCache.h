@@ -0,0 +1,87 @@
+#ifndef EntityCache_h
+#define EntityCache_h
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+/*
+  Bounded read-through cache of entities, keyed by (table, partition, row).
+
+  The cache is split into shards, each with its own lock and its own
+  least-recently-used list, so that concurrent requests for different
+  entities rarely contend. Entries expire ttl after they were inserted.
+
+  A lookup that misses returns a ticket, which must be passed to the
+  insert() of the entity read from storage. Any invalidation in the
+  shard between the two voids the ticket, so an entity read before a
+  concurrent write can never be cached after that write's invalidation.
+ */
+class EntityCache {
+public:
+  using ticket_t = unsigned long long;
+  using cache_clock = std::chrono::steady_clock;
+
+private:
+  static constexpr std::size_t shard_count {16};
+
+  struct entry_t {
+    azure::storage::table_entity entity;
+    cache_clock::time_point expires;
+    std::list<std::string>::iterator position;
+  };
+
+  struct shard_t {
+    // Keys in order of use, most recent first
+    std::list<std::string> lru {};
+    std::unordered_map<std::string,entry_t> entries {};
+    ticket_t invalidations {};
+    pplx::extensibility::critical_section_t lock {};
+  };
+
+  std::size_t shard_capacity;
+  cache_clock::duration ttl;
+  std::array<shard_t,shard_count> shards;
+  std::atomic<unsigned long long> hit_count;
+  std::atomic<unsigned long long> miss_count;
+
+  shard_t& shard_for(const std::string& key);
+  void erase(shard_t& shard, std::unordered_map<std::string,entry_t>::iterator entry);
+
+public:
+  EntityCache (std::size_t capacity, cache_clock::duration entry_ttl) :
+    shard_capacity {capacity / shard_count > 0 ? capacity / shard_count : 1},
+    ttl (entry_ttl),
+    shards {},
+    hit_count {0},
+    miss_count {0}
+    {};
+
+  bool lookup(const std::string& table_name,
+              const std::string& partition,
+              const std::string& row,
+              azure::storage::table_entity& entity,
+              ticket_t& ticket);
+  void insert(const std::string& table_name,
+              const std::string& partition,
+              const std::string& row,
+              const azure::storage::table_entity& entity,
+              ticket_t ticket);
+  void invalidate(const std::string& table_name,
+                  const std::string& partition,
+                  const std::string& row);
+  void invalidate_table(const std::string& table_name);
+
+  unsigned long long hits() const { return hit_count; };
+  unsigned long long misses() const { return miss_count; };
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef FriendSet_h
+#define FriendSet_h
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "ClientUtils.h"
+
+/*
+  A set of friends, each a (country, name) pair, with hashed
+  membership. Inserting a friend already in the set does nothing,
+  and the friends are listed in the order they were first inserted,
+  so a list read and written back keeps its order. Erasing a friend
+  takes time linear in the size of the set.
+
+  The set reads and writes the friends-list strings described at
+  parse_friends_list(), which remain the stored form, so lists
+  written before duplicates were dropped can still be read.
+ */
+class FriendSet {
+private:
+  // Each friend encoded as country + pair_delimiter + name
+  std::unordered_set<std::string> members;
+  // The encoded friends in order of insertion
+  std::vector<std::string> order;
+
+  static std::string key(const std::string& country, const std::string& name);
+
+public:
+  FriendSet () : members {}, order {} {};
+
+  /*
+    Parse a friends-list string, keeping the first of any duplicates.
+    Throws std::invalid_argument where parse_friends_list() would.
+   */
+  explicit FriendSet (const std::string& friends_list);
+
+  // Return false if the friend was already in the set
+  bool insert(const std::string& country, const std::string& name);
+  // Return false if the friend was not in the set
+  bool erase(const std::string& country, const std::string& name);
+  bool contains(const std::string& country, const std::string& name) const;
+
+  std::size_t size() const { return members.size(); };
+  bool empty() const { return members.empty(); };
+
+  // The friends, in order of insertion
+  friends_list_t list() const;
+  // The friends as a friends-list string in standard form
+  std::string to_string() const;
+};
+
+#endif
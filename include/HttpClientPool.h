@@ -0,0 +1,70 @@
+#ifndef HttpClientPool_h
+#define HttpClientPool_h
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <cpprest/base_uri.h>
+#include <cpprest/http_client.h>
+
+#include <pplx/pplxtasks.h>
+
+/*
+  Bounded pool of HTTP clients, keyed by (scheme, host, port).
+
+  An http_client keeps its connections open between requests, so
+  sharing one client per server lets successive requests reuse a
+  connection instead of opening a new one each time. A client unused
+  for idle_timeout is closed, as is the least recently used client
+  when the pool is full.
+ */
+class HttpClientPool {
+public:
+  using pool_clock = std::chrono::steady_clock;
+
+private:
+  struct entry_t {
+    std::shared_ptr<web::http::client::http_client> client;
+    pool_clock::time_point last_used;
+    std::list<std::string>::iterator position;
+  };
+
+  std::size_t capacity;
+  pool_clock::duration idle_timeout;
+  // Keys in order of use, most recent first
+  std::list<std::string> lru;
+  std::unordered_map<std::string,entry_t> entries;
+  std::atomic<unsigned long long> hit_count;
+  std::atomic<unsigned long long> miss_count;
+  pplx::extensibility::critical_section_t lock;
+
+  void erase(std::unordered_map<std::string,entry_t>::iterator entry);
+
+public:
+  HttpClientPool (std::size_t max_clients, pool_clock::duration idle) :
+    capacity {max_clients > 0 ? max_clients : 1},
+    idle_timeout (idle),
+    lru {},
+    entries {},
+    hit_count {0},
+    miss_count {0},
+    lock {}
+    {};
+
+  /*
+    Return the client for the server named by target, which may
+    include a path; only its scheme, host and port are used. Requests
+    through the client take the path of their own URI.
+   */
+  std::shared_ptr<web::http::client::http_client> lookup_client(const web::uri& target);
+
+  unsigned long long hits() const { return hit_count; };
+  unsigned long long misses() const { return miss_count; };
+};
+
+#endif
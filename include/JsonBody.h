@@ -0,0 +1,70 @@
+#ifndef JsonBody_h
+#define JsonBody_h
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <cpprest/http_listener.h>
+
+#include <pplx/pplxtasks.h>
+
+/*
+  Return true if an HTTP request has a JSON body
+
+  This routine can be called multiple times on the same message.
+ */
+bool has_json_body (web::http::http_request message);
+
+/*
+  Given an HTTP message with a JSON body, return the JSON
+  body as an unordered map of strings to strings.
+  get_json_body and get_json_bourne are valid and identical function calls.
+
+  If the message has no JSON body, return an empty map.
+  Blocks until the body has arrived; see get_json_body_async().
+
+  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
+  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
+  for source of this limit).
+
+  Note that all types of JSON values are returned as strings.
+  Use C++ conversion utilities to convert to numbers or dates
+  as necessary.
+ */
+std::unordered_map<std::string,std::string> get_json_body(web::http::http_request message);
+std::unordered_map<std::string,std::string> get_json_bourne(web::http::http_request message);
+
+/*
+  As get_json_body(), but fill results, which is cleared first, so
+  that a caller handling many bodies can reuse one map.
+ */
+void get_json_body(web::http::http_request message,
+                   std::unordered_map<std::string,std::string>& results);
+
+/*
+  As get_json_body(), but without blocking: the task completes once
+  the body has arrived. If the body is not valid JSON, the task fails.
+ */
+pplx::task<std::unordered_map<std::string,std::string>>
+get_json_body_async(web::http::http_request message);
+
+/*
+  For a server handling message: call use with the JSON body of
+  message, as returned by get_json_body(), once the body has arrived.
+  If the body is not valid JSON, reply BadRequest instead.
+ */
+void with_json_body(web::http::http_request message,
+                    std::function<void (const std::unordered_map<std::string,std::string>&)> use);
+
+/*
+  Parse text as a JSON object whose values are all strings, adding
+  each property to results in a single pass over text.
+
+  Returns false, leaving results in an unspecified state, if text is
+  not such an object; the caller must then fall back to a full parse.
+ */
+bool parse_flat_json_object(const std::string& text,
+                            std::unordered_map<std::string,std::string>& results);
+
+#endif
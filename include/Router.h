@@ -0,0 +1,91 @@
+#ifndef Router_h
+#define Router_h
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cpprest/http_listener.h>
+
+/*
+  Dispatch table for the requests of one HTTP method.
+
+  Each operation name (the first segment of the path) is registered
+  once with its handler and the number of path segments it accepts,
+  including the operation name itself. dispatch() splits the path of
+  a request once, looks the operation up in a hash table and checks
+  the segment count before calling the handler, so handlers receive
+  a path that is already known to have a valid shape. Requests naming
+  no registered operation, or with the wrong number of segments, get
+  BadRequest.
+
+  The path is split before its segments are decoded, so an encoded
+  '/' (as in a SAS token) stays inside its segment.
+
+  Routes are registered at startup, before the listener is opened;
+  dispatch() does not modify the router and may run concurrently.
+
+  The time to reply to the first request dispatched is logged, to
+  show what a cold start costs.
+ */
+class Router {
+public:
+  using paths_t = std::vector<std::string>;
+  using handler_t = std::function<void(web::http::http_request, const paths_t&)>;
+
+private:
+  struct route_t {
+    std::size_t min_paths;
+    std::size_t max_paths;
+    handler_t handler;
+  };
+
+  std::unordered_map<std::string,route_t> routes;
+  mutable std::atomic<bool> dispatched;
+
+public:
+  Router () : routes {}, dispatched {false} {};
+
+  /*
+    Register handler for operation, accepting paths of min_paths to
+    max_paths segments. Throws invalid_argument if the operation is
+    already registered or the segment counts are inconsistent.
+   */
+  void add(const std::string& operation,
+           std::size_t min_paths, std::size_t max_paths,
+           handler_t handler);
+  void add(const std::string& operation, std::size_t paths, handler_t handler) {
+    add(operation, paths, paths, handler);
+  };
+
+  void dispatch(web::http::http_request message) const;
+
+  static paths_t split_path(const std::string& undecoded_path);
+};
+
+/*
+  The routers of one server, one for each HTTP method it handles.
+
+  dispatch() passes a request to the router for its method, replying
+  MethodNotAllowed for any other method, as a listener does. A service
+  can both be attached to a listener with support() and be called
+  directly, by a client in the same process, with dispatch().
+ */
+class Service {
+private:
+  std::unordered_map<web::http::method,Router> routers;
+
+public:
+  Service () : routers {} {};
+
+  // The router for method, created empty on first use
+  Router& routes(const web::http::method& method) { return routers[method]; };
+
+  void dispatch(web::http::http_request message) const;
+  void support(web::http::experimental::listener::http_listener& listener) const;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SasToken_h
+#define SasToken_h
+
+#include <chrono>
+#include <string>
+
+#include <cpprest/asyncrt_utils.h>
+
+/*
+  The fields of a table shared access signature that can be checked
+  without asking Azure. The signature itself can only be checked by
+  Azure, so a token that passes these checks may still be rejected.
+
+  Empty strings stand for fields absent from the token.
+ */
+struct sas_token_t {
+  std::string table {};          // tn
+  std::string permissions {};    // sp, e.g. "r" or "ru"
+  std::string policy {};         // si, a stored access policy
+  std::string start_partition {};  // spk
+  std::string start_row {};        // srk
+  std::string end_partition {};    // epk
+  std::string end_row {};          // erk
+  utility::datetime expiry {};   // se; uninitialized if absent
+  bool has_signature {false};    // sig
+};
+
+/*
+  Parse token, an undecoded SAS query string (with or without a
+  leading '?'), into fields, decoding each value.
+
+  Returns false if token is not a SAS: it has no signature, it has
+  neither permissions nor a stored access policy, or its expiry is not
+  a valid ISO 8601 time.
+ */
+bool parse_sas_token(const std::string& token, sas_token_t& fields);
+
+/*
+  Return true if the token's own fields can be checked locally: it
+  does not leave its permissions to a stored access policy. A policy
+  may also hold the expiry and start time, and only Azure can read it.
+ */
+bool sas_checkable(const sas_token_t& fields);
+
+/*
+  Return true if the token grants permission (one of the letters of
+  the "sp" field, such as 'r' or 'u').
+ */
+bool sas_allows(const sas_token_t& fields, char permission);
+
+/*
+  Return true if the token is unexpired at now and covers the entity
+  (partition, row) of table. Names are compared decoded; table names
+  are compared ignoring case, as Azure does.
+ */
+bool sas_covers(const sas_token_t& fields,
+                const std::string& table,
+                const std::string& partition,
+                const std::string& row,
+                const utility::datetime& now);
+
+/*
+  Time remaining before token expires, from its "se" field, or
+  fallback if token is not a SAS or has no expiry. Zero if the
+  token has expired.
+ */
+std::chrono::steady_clock::duration sas_lifetime(const std::string& token,
+                                                 std::chrono::steady_clock::duration fallback);
+
+#endif
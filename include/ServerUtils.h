@@ -2,19 +2,39 @@
 #define ServerUtils_h
 
 #include <string>
+#include <unordered_map>
 #include <utility>
 
 #include <cpprest/http_listener.h>
 
+#include <pplx/pplxtasks.h>
+
 #include <was/table.h>
 
-std::pair<web::http::status_code,azure::storage::table_entity>
-read_with_token(const web::http::http_request& message,
-                const std::string& endpoint);
+#include "TokenClientPool.h"
+
+// Table references for SAS tokens, shared by the *_with_token functions
+extern TokenClientPool token_client_pool;
+
+pplx::task<std::pair<web::http::status_code,azure::storage::table_entity>>
+read_with_token_async(const web::http::http_request& message,
+                      const std::string& endpoint);
+
+
+pplx::task<web::http::status_code>
+update_with_token_async (const web::http::http_request& message,
+                         const std::string& endpoint,
+                         const std::unordered_map<std::string,std::string>& props);
+
+// Elements of a list property are separated by this character
+extern const char list_separator;
 
+enum class list_edit {append, remove};
 
-web::http::status_code
-update_with_token (const web::http::http_request& message,
-                   const std::string& endpoint,
-                   const std::unordered_map<std::string,std::string>& props);
+pplx::task<web::http::status_code>
+edit_list_with_token_async (const web::http::http_request& message,
+                            const std::string& endpoint,
+                            const std::string& prop,
+                            const std::string& item,
+                            list_edit edit);
 #endif
@@ -0,0 +1,38 @@
+#ifndef Services_h
+#define Services_h
+
+#include <string>
+#include <vector>
+
+#include "Router.h"
+
+/*
+  The four servers, each of which can run as its own process or be
+  hosted with the others in one (see CombinedServer.cpp).
+
+  start() initializes a server, given its command-line arguments, and
+  registers its routes in service; stop() shuts it down once its
+  listener has closed. Building with COMBINED_SERVERS omits each
+  server's own main().
+ */
+namespace basic_service {
+  void start (Service& service, const std::vector<std::string>& args);
+  void stop ();
+}
+
+namespace auth_service {
+  void start (Service& service, const std::vector<std::string>& args);
+  void stop ();
+}
+
+namespace user_service {
+  void start (Service& service, const std::vector<std::string>& args);
+  void stop ();
+}
+
+namespace push_service {
+  void start (Service& service, const std::vector<std::string>& args);
+  void stop ();
+}
+
+#endif
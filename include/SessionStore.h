@@ -0,0 +1,122 @@
+#ifndef SessionStore_h
+#define SessionStore_h
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include <pplx/pplxtasks.h>
+
+/*
+  Sessions of signed-on users, keyed by user ID, safe to use from
+  the concurrent handlers of a listener.
+
+  The store is split into shards, each with its own lock, so that
+  requests for different users rarely contend. A session expires
+  after the ttl given when it was inserted, normally the remaining
+  life of its token. Expired sessions are never returned; they are
+  dropped when looked up, and swept from a shard when it has grown
+  to twice its size at the previous sweep.
+
+  Once open() has been called, the store persists itself in files
+  named from its path: path holds a snapshot of every session, and
+  path.log every change made since, so that a restarted server keeps
+  its sessions. Both are sequences of binary records in native byte
+  order, holding the expiry as wall-clock time. snapshot() writes a
+  new snapshot and starts a new log, moving the old one to
+  path.log.old until the snapshot is safely renamed into place.
+
+  The files hold every session's token, which grants access to the
+  user's data until it expires, so they are as sensitive as the
+  tokens themselves. They are created readable and writable by the
+  owner only (mode 0600), and existing files are restricted to that
+  mode when opened.
+
+  Changes are buffered in their shard, under the shard's own lock,
+  and written to the log by flush(), so handlers for different users
+  never wait on one another to log.
+ */
+class SessionStore {
+public:
+  using store_clock = std::chrono::steady_clock;
+
+  struct session_t {
+    std::string token;
+    std::string partition;
+    std::string row;
+  };
+
+private:
+  static constexpr std::size_t shard_count {16};
+  static constexpr std::size_t min_sweep_size {64};
+
+  struct entry_t {
+    session_t session;
+    store_clock::time_point expires;
+  };
+
+  struct shard_t {
+    std::unordered_map<std::string,entry_t> entries {};
+    std::size_t sweep_size {min_sweep_size};
+    // Log records of changes not yet flushed, oldest first
+    std::string pending {};
+    pplx::extensibility::critical_section_t lock {};
+  };
+
+  std::array<shard_t,shard_count> shards;
+
+  std::string snapshot_path;
+  std::ofstream log;
+  // Guards log, and is held while pending records are moved to it
+  pplx::extensibility::critical_section_t log_lock;
+
+  shard_t& shard_for(const std::string& userid);
+  // Caller must hold log_lock
+  void write_pending();
+  std::size_t replay(const std::string& path, std::size_t& complete);
+  bool write_snapshot();
+
+public:
+  SessionStore () :
+    shards {},
+    snapshot_path {},
+    log {},
+    log_lock {}
+    {};
+
+  // Add or replace the session of userid
+  void insert(const std::string& userid,
+              const session_t& session,
+              store_clock::duration ttl);
+  // Return false if userid has no unexpired session
+  bool lookup(const std::string& userid, session_t& session);
+  // Return false if userid had no unexpired session
+  bool erase(const std::string& userid);
+
+  /*
+    Load the sessions saved at path, dropping expired ones, into the
+    store, setting loaded to their number, and log every later change
+    there.
+
+    Returns false if the log could not be opened so that new records
+    follow only complete ones; the loaded sessions are kept, but
+    nothing is saved from then on: later changes are not logged, and
+    snapshot() fails too, as a snapshot without a fresh log to follow
+    it could be overridden by stale records in the old one.
+   */
+  bool open(const std::string& path, std::size_t& loaded);
+  // Write buffered changes to the log
+  void flush();
+  /*
+    Write a snapshot of all unexpired sessions and start a new log.
+    Returns false if the snapshot could not be written, in which case
+    the previous snapshot and logs remain valid. Must not be called
+    concurrently with itself or open().
+   */
+  bool snapshot();
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef Settings_h
+#define Settings_h
+
+#include <chrono>
+#include <cstddef>
+
+/*
+  Tuning settings read from the environment, so that a server can be
+  configured the same way whether it runs alone or in combinedserver,
+  which passes no command-line arguments on to the servers.
+
+  If the variable name is unset, or is not a non-negative decimal
+  integer, the default is returned.
+ */
+std::size_t env_size (const char* name, std::size_t default_value);
+
+// As env_size(), for a duration given as a number of seconds
+std::chrono::seconds env_seconds (const char* name, std::chrono::seconds default_value);
+
+#endif
@@ -1,35 +1,104 @@
 #ifndef TableCache_h
 #define TableCache_h
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <pplx/pplxtasks.h>
 
 #include <was/storage_account.h>
 #include <was/table.h>
 
+/*
+  Cache of opened tables, along with whether each table is known to exist.
+
+  Only existence is cached: a table that is not known to exist is checked
+  against Azure on every call to table_exists(), so tables created by
+  another process are seen at once. If a recheck interval is given to
+  init(), an existing table whose state is older than the interval is
+  rechecked in the background, while callers keep the cached answer.
+  So a table deleted by another process is reported as existing until
+  that recheck completes, up to the interval and the time of one Azure
+  call later. delete_entry() forgets a table deleted by this process
+  at once. With no interval, existing tables are never rechecked.
+
+  Reads take no lock: every change to the cache, made under resplock,
+  publishes an immutable copy of it and bumps an atomic version count.
+  Each thread keeps its own reference to the copy it last read, so
+  lookup_table() and the common case of table_exists() cost one atomic
+  load of the version and no reference counting; only a thread that
+  finds the version changed takes resplock, once, to pick up the new
+  copy. Changes are rare (a table seen for the first time, a change in
+  existence, a recheck), so copying is cheap overall. A thread's old
+  copy is freed when it picks up the next, or when the thread ends.
+
+  table_exists() blocks on Azure when the cache misses, as do warm_up()
+  and warm_up_all(), which are meant for startup. Handlers running on
+  the listener's threads should use table_exists_async().
+ */
 class TableCache {
 private:
+  struct entry_t {
+    azure::storage::cloud_table table {};
+    bool exists {false};
+    bool rechecking {false};
+    std::chrono::steady_clock::time_point checked {};
+  };
+
+  using snapshot_t = std::unordered_map<std::string,entry_t>;
+
+  // Source of id, so that threads never mistake one cache for another
+  static std::atomic<unsigned long long> next_id;
+
   azure::storage::cloud_storage_account account;
   azure::storage::cloud_table_client client;
-  std::unordered_map<std::string,azure::storage::cloud_table> table_cache;
+  snapshot_t table_cache;
+  // Copy of table_cache as of the last change, and the number of
+  // changes; both are set only under resplock
+  std::shared_ptr<const snapshot_t> snapshot;
+  std::atomic<unsigned long long> version;
+  const unsigned long long id;
+  std::chrono::steady_clock::duration recheck_interval;
+  unsigned long long deletions;
   pplx::extensibility::critical_section_t resplock;
+
+  entry_t& find_or_add(const std::string& table_name, bool& added);
+  void publish();
+  const snapshot_t& current();
+  void recheck(const std::string& table_name, entry_t& entry);
 public:
   TableCache () : 
     account {},
     client {},
     table_cache {},
+    snapshot {std::make_shared<const snapshot_t>()},
+    version {0},
+    id {next_id++},
+    recheck_interval {},
+    deletions {0},
     resplock {}
     {};
 
-  void init(const std::string& connection) {
+  void init(const std::string& connection,
+            std::chrono::steady_clock::duration recheck = std::chrono::steady_clock::duration::zero()) {
     account  = azure::storage::cloud_storage_account::parse(connection);
     client = account.create_cloud_table_client();
+    recheck_interval = recheck;
   };
 
   azure::storage::cloud_table lookup_table(const std::string& table_name);
+  pplx::task<bool> table_exists_async(const std::string& table_name);
+  bool table_exists(const std::string& table_name);
+  pplx::task<bool> create_table_async(const std::string& table_name);
   bool delete_entry(const std::string& table_name);
+
+  std::size_t warm_up(const std::vector<std::string>& table_names);
+  std::size_t warm_up_all();
 };
 
 #endif
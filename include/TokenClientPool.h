@@ -0,0 +1,70 @@
+#ifndef TokenClientPool_h
+#define TokenClientPool_h
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+/*
+  Bounded pool of table references authenticated by SAS tokens, keyed
+  by (endpoint, table, token).
+
+  Building the credentials, client and table reference for a token is
+  done once per token rather than once per request. An entry expires
+  when its token does, as given by the token's "se" (signed expiry)
+  field, or after fallback_ttl if the token has no readable expiry.
+  When the pool is full, the least recently used entry is evicted.
+ */
+class TokenClientPool {
+public:
+  using pool_clock = std::chrono::steady_clock;
+
+private:
+  struct entry_t {
+    azure::storage::cloud_table table;
+    pool_clock::time_point expires;
+    std::list<std::string>::iterator position;
+  };
+
+  std::size_t capacity;
+  pool_clock::duration fallback_ttl;
+  // Keys in order of use, most recent first
+  std::list<std::string> lru;
+  std::unordered_map<std::string,entry_t> entries;
+  std::atomic<unsigned long long> hit_count;
+  std::atomic<unsigned long long> miss_count;
+  pplx::extensibility::critical_section_t lock;
+
+  void erase(std::unordered_map<std::string,entry_t>::iterator entry);
+
+public:
+  TokenClientPool (std::size_t max_entries, pool_clock::duration ttl) :
+    capacity {max_entries > 0 ? max_entries : 1},
+    fallback_ttl (ttl),
+    lru {},
+    entries {},
+    hit_count {0},
+    miss_count {0},
+    lock {}
+    {};
+
+  /*
+    Return a reference to table_name at endpoint, authenticated by
+    token, an undecoded SAS query string.
+   */
+  azure::storage::cloud_table lookup_table(const std::string& endpoint,
+                                           const std::string& table_name,
+                                           const std::string& token);
+
+  unsigned long long hits() const { return hit_count; };
+  unsigned long long misses() const { return miss_count; };
+};
+
+#endif
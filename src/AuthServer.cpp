@@ -5,7 +5,15 @@
  http://localhost:34570.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -16,8 +24,12 @@
 #include <was/common.h>
 #include <was/table.h>
 
+#include "../include/EntityCache.h"
+#include "../include/JsonBody.h"
 #include "../include/make_unique.h"
+#include "../include/Router.h"
 #include "../include/ServerUrls.h"
+#include "../include/Services.h"
 #include "../include/TableCache.h"
 
 #include "../include/azure_keys.h"
@@ -25,6 +37,7 @@
 using azure::storage::storage_exception;
 using azure::storage::cloud_table;
 using azure::storage::cloud_table_client;
+using azure::storage::continuation_token;
 using azure::storage::edm_type;
 using azure::storage::entity_property;
 using azure::storage::query_comparison_operator;
@@ -32,11 +45,14 @@ using azure::storage::query_logical_operator;
 using azure::storage::table_entity;
 using azure::storage::table_operation;
 using azure::storage::table_query;
-using azure::storage::table_query_iterator;
+using azure::storage::table_query_segment;
 using azure::storage::table_request_options;
 using azure::storage::table_result;
 using azure::storage::table_shared_access_policy;
 
+using pplx::extensibility::critical_section_t;
+using pplx::extensibility::scoped_critical_section_t;
+
 using std::cin;
 using std::cout;
 using std::endl;
@@ -60,6 +76,8 @@ using web::http::experimental::listener::http_listener;
 
 using prop_str_vals_t = vector<pair<string,string>>;
 
+namespace auth_service {
+
 const string auth_table_name {"AuthTable"};
 const string auth_table_userid_partition {"Userid"};
 const string auth_table_password_prop {"Password"};
@@ -70,12 +88,236 @@ const string data_table_name {"DataTable"};
 const string get_read_token_op {"GetReadToken"};
 const string get_update_token_op {"GetUpdateToken"};
 const string get_update_data_op {"GetUpdateData"};
+const string get_update_data_bulk_op {"GetUpdateDataBulk"};
+const string invalidate_credentials_op {"InvalidateCredentialsAdmin"};
+
+/*
+  A bulk token request reads AuthTable with one query per batch of
+  bulk_read_batch_size users, running at most bulk_read_parallelism
+  queries at once so that one large request cannot flood storage.
+  Azure allows at most 15 comparisons in a filter, and each query
+  compares the partition once and the row once per user, so a batch
+  holds at most 14 users.
+ */
+constexpr std::size_t bulk_max_users {10000};
+constexpr std::size_t bulk_read_batch_size {14};
+constexpr std::size_t bulk_read_parallelism {8};
 
 /*
-  Cache of opened tables
+  Cache of opened tables, rechecking existing tables every minute.
+  A table deleted by another process is still reported as existing
+  for up to table_recheck_interval (see TableCache).
  */
+constexpr std::chrono::seconds table_recheck_interval {60};
 TableCache table_cache {};
 
+/*
+  Cache of AuthTable entities, so that repeat token requests for a
+  user do not read storage. Passwords are checked against the cached
+  entity only: a wrong password is rejected without reading storage,
+  so guessing passwords cannot be used to load AuthTable.
+
+  AuthServer does not write AuthTable itself. Whoever changes a user's
+  entry there should then call InvalidateCredentialsAdmin for the
+  user, so that the next request reads the new entry. Otherwise the
+  change takes effect only when the entry expires, up to
+  credential_cache_ttl after the user's last read from storage.
+ */
+constexpr std::size_t credential_cache_capacity {10000};
+constexpr std::chrono::minutes credential_cache_ttl {1};
+EntityCache credential_cache {credential_cache_capacity, credential_cache_ttl};
+
+// Result of read_credentials(): a status code and the entity read
+using credentials_result_t = pair<status_code,table_entity>;
+
+/*
+  Read the AuthTable entity holding the credentials of userid,
+  from credential_cache if it is there, otherwise by a point
+  retrieve from table, caching the result. The task is complete at
+  once on a cache hit; otherwise it completes when Azure responds,
+  and no thread waits meanwhile.
+
+  The status of the result is:
+    OK if the entity was read
+    NotFound if there is no such user
+    InternalError if the read from storage failed
+ */
+pplx::task<credentials_result_t> read_credentials (const cloud_table& table,
+                                                   const string& userid) {
+  table_entity credentials;
+  EntityCache::ticket_t ticket;
+  if (credential_cache.lookup(auth_table_name, auth_table_userid_partition,
+                              userid, credentials, ticket))
+    return pplx::task_from_result(make_pair(static_cast<status_code>(status_codes::OK), credentials));
+
+  return table.execute_async(table_operation::retrieve_entity(auth_table_userid_partition, userid))
+    .then([userid, ticket] (pplx::task<table_result> retrieve) -> credentials_result_t
+          {
+            table_result retrieve_result {};
+            try {
+              retrieve_result = retrieve.get();
+            }
+            catch (const storage_exception& e) {
+              cout << "Azure Table Storage error: " << e.what() << endl;
+              return make_pair(static_cast<status_code>(status_codes::InternalError), table_entity {});
+            }
+            if (retrieve_result.http_status_code() == status_codes::NotFound)
+              return make_pair(static_cast<status_code>(status_codes::NotFound), table_entity {});
+            if (retrieve_result.http_status_code() != status_codes::OK)
+              return make_pair(static_cast<status_code>(status_codes::InternalError), table_entity {});
+
+            credential_cache.insert(auth_table_name, auth_table_userid_partition,
+                                    userid, retrieve_result.entity(), ticket);
+            return make_pair(static_cast<status_code>(status_codes::OK), retrieve_result.entity());
+          });
+}
+
+/*
+  Call found once AuthTable and DataTable are both known to exist.
+  Otherwise reply InternalError to message.
+
+  Tables already known to exist are found at once; otherwise found
+  is called from a continuation once Azure has answered, and no
+  thread waits meanwhile. DataTable is checked only once AuthTable
+  is known to exist, so a failed check is never left unobserved.
+ */
+void if_tables_exist (http_request message, std::function<void ()> found) {
+  table_cache.table_exists_async(auth_table_name)
+    .then([] (bool auth_exists) -> pplx::task<bool>
+          {
+            if ( ! auth_exists)
+              return pplx::task_from_result(false);
+            return table_cache.table_exists_async(data_table_name);
+          })
+    .then([message, found] (pplx::task<bool> exist)
+          {
+            try {
+              if ( ! exist.get()) {
+                message.reply(status_codes::InternalError);
+                return;
+              }
+            }
+            catch (const std::exception& e) {
+              cout << e.what() << endl;
+              message.reply(status_codes::InternalError);
+              return;
+            }
+            found();
+          });
+}
+
+/*
+  State of a GetUpdateDataBulk read of AuthTable, shared by its
+  continuations
+ */
+struct bulk_read_t {
+  cloud_table table {};
+  vector<string> userids {};
+  std::size_t batch_count {};
+  std::atomic<std::size_t> next_batch {0};
+  // Credentials read so far, guarded by lock
+  unordered_map<string,table_entity> found {};
+  critical_section_t lock {};
+};
+
+/*
+  Add the credentials of userid to those found by state.
+ */
+void add_found (bulk_read_t& state, const string& userid, const table_entity& credentials) {
+  scoped_critical_section_t l {state.lock};
+  state.found[userid] = credentials;
+}
+
+/*
+  Read the segments of query from token onwards, adding each entity
+  named in missed to the credentials found by state and caching it
+  with its ticket.
+ */
+pplx::task<void> read_credential_segments (std::shared_ptr<bulk_read_t> state,
+                                           table_query query,
+                                           continuation_token token,
+                                           std::shared_ptr<unordered_map<string,EntityCache::ticket_t>> missed) {
+  return state->table.execute_query_segmented_async(query, token)
+    .then([state, query, missed] (table_query_segment segment) -> pplx::task<void>
+          {
+            for (const auto& entity : segment.results()) {
+              auto ticket (missed->find(entity.row_key()));
+              if (ticket == missed->end())
+                continue;
+              credential_cache.insert(auth_table_name, auth_table_userid_partition,
+                                      entity.row_key(), entity, ticket->second);
+              add_found(*state, entity.row_key(), entity);
+            }
+            if (segment.continuation_token().empty())
+              return pplx::task_from_result();
+            return read_credential_segments(state, query, segment.continuation_token(), missed);
+          });
+}
+
+/*
+  Read the credentials of the users in batch number batch of
+  state->userids into state->found, taking them from credential_cache
+  where possible and reading the rest with a single query of
+  AuthTable, caching what it returns.
+
+  Users with no entity in AuthTable are left out of found. No thread
+  is blocked while the query runs.
+ */
+pplx::task<void> read_credentials_batch (std::shared_ptr<bulk_read_t> state, std::size_t batch) {
+  auto missed (std::make_shared<unordered_map<string,EntityCache::ticket_t>>());
+  string rows_filter {};
+  const std::size_t last {std::min(state->userids.size(), (batch + 1) * bulk_read_batch_size)};
+  for (std::size_t i {batch * bulk_read_batch_size}; i < last; ++i) {
+    const string& userid (state->userids[i]);
+    table_entity credentials;
+    EntityCache::ticket_t ticket;
+    if (credential_cache.lookup(auth_table_name, auth_table_userid_partition,
+                                userid, credentials, ticket)) {
+      add_found(*state, userid, credentials);
+      continue;
+    }
+    (*missed)[userid] = ticket;
+
+    string condition {
+      table_query::generate_filter_condition("RowKey",
+                                             query_comparison_operator::equal,
+                                             userid)};
+    if (rows_filter.empty())
+      rows_filter = condition;
+    else
+      rows_filter = table_query::combine_filter_conditions(rows_filter,
+                                                           query_logical_operator::op_or,
+                                                           condition);
+  }
+  if (missed->empty())
+    return pplx::task_from_result();
+
+  table_query query {};
+  query.set_filter_string(
+    table_query::combine_filter_conditions(
+      table_query::generate_filter_condition("PartitionKey",
+                                             query_comparison_operator::equal,
+                                             auth_table_userid_partition),
+      query_logical_operator::op_and,
+      rows_filter));
+  return read_credential_segments(state, query, continuation_token {}, missed);
+}
+
+/*
+  Read batches of state->userids, taking the next unread batch each
+  time, until none are left.
+ */
+pplx::task<void> read_credentials_worker (std::shared_ptr<bulk_read_t> state) {
+  const std::size_t batch {state->next_batch++};
+  if (batch >= state->batch_count)
+    return pplx::task_from_result();
+  return read_credentials_batch(state, batch)
+    .then([state] ()
+          {
+            return read_credentials_worker(state);
+          });
+}
+
 /*
   Convert properties represented in Azure Storage type
   to prop_str_vals_t type.
@@ -95,66 +337,97 @@ prop_str_vals_t get_string_properties (const table_entity::properties_type& prop
 }
 
 /*
-  Return true if an HTTP request has a JSON body
-
-  This routine can be called multiple times on the same message.
+  Check password_given against the credentials read from AuthTable,
+  setting partition and row to the DataTable entity they grant.
+
+  Returns:
+    OK if the password matches
+    NotFound if it does not---the same status as an unknown user
+    InternalError if the entity lacks a required property or has
+      one that does not belong in AuthTable
  */
-bool has_json_body (http_request message) {
-  return message.headers()["Content-type"] == "application/json";
+status_code authenticate (const table_entity& credentials,
+                          const string& password_given,
+                          string& partition,
+                          string& row) {
+  string password_actual;
+  prop_str_vals_t properties = get_string_properties(credentials.properties());
+  for(auto p : properties) {
+    string property_name = p.first;
+    if(property_name == auth_table_password_prop) {
+      password_actual = p.second;
+    }
+    else if(property_name == auth_table_partition_prop) {
+      partition = p.second;
+    }
+    else if(property_name == auth_table_row_prop) {
+      row = p.second;
+    }
+    else {
+      // Invalid property
+      return status_codes::InternalError;
+    }
+  }
+
+  if( password_actual.empty() ||
+      partition.empty() ||
+      row.empty() ) {
+    // At least one of the necessary properties not found
+    return status_codes::InternalError;
+  }
+  else if(password_given != password_actual) {
+    // Incorrect Password
+    // Same status code as incorrect user ID for security purposes
+    return status_codes::NotFound;
+  }
+  return status_codes::OK;
 }
 
 /*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-  get_json_body and get_json_bourne are valid and identical function calls.
-
-  If the message has no JSON body, return an empty map.
-
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
-
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
+  Tokens issued by do_get_token(), keyed by table, partition, row,
+  permissions and signing key. A token is handed out again until less
+  than token_refresh_margin of its lifetime remains, so signing is
+  done about once a day per entity and clients see a stable token.
+  Once the storage account key is replaced, the tokens signed with
+  the old key no longer match any request and age out of the cache.
+
+  A token found inside the margin is dropped, and when the cache
+  holds issued_tokens_capacity tokens the least recently used one is
+  evicted, as in TokenClientPool.
  */
-unordered_map<string,string> get_json_body(http_request message) {
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
-
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-          {
-            json = v;
-            return true;
-          })
-    .wait();
+struct issued_token_t {
+  string token;
+  std::chrono::steady_clock::time_point expires;
+  std::list<string>::iterator position;
+};
+constexpr std::chrono::hours token_lifetime {24};
+constexpr std::chrono::hours token_refresh_margin {1};
+constexpr std::size_t issued_tokens_capacity {10000};
+// Keys in order of use, most recent first
+std::list<string> issued_tokens_lru {};
+unordered_map<string,issued_token_t> issued_tokens {};
+critical_section_t issued_tokens_lock {};
 
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-        results[v.first] = v.second.as_string();
-      }
-      else {
-        results[v.first] = v.second.serialize();
-      }
-    }
-  }
-  return results;
+/*
+  Return a fingerprint of the account key that signs tokens for
+  table, to tell apart tokens signed before and after a key change
+ */
+string signing_key_id (const cloud_table& table) {
+  const vector<uint8_t> key {table.service_client().credentials().account_key()};
+  return std::to_string(std::hash<string> {}(string(key.begin(), key.end())));
 }
 
-unordered_map<string,string> get_json_bourne(http_request message) {
- return get_json_body(message);
+// Caller must hold issued_tokens_lock
+void erase_issued_token (unordered_map<string,issued_token_t>::iterator issued) {
+  issued_tokens_lru.erase(issued->second.position);
+  issued_tokens.erase(issued);
 }
 
 /*
   Return a token for 24 hours of access to the specified table,
   for the single entity defind by the partition and row.
+  A token issued earlier for the same entity and permissions
+  is returned while it has at least token_refresh_margin left.
 
   permissions: A bitwise OR ('|')  of table_shared_access_poligy::permission
     constants.
@@ -170,7 +443,25 @@ pair<status_code,string> do_get_token (const cloud_table& data_table,
                    const string& row,
                    uint8_t permissions) {
 
-  utility::datetime exptime {utility::datetime::utc_now() + utility::datetime::from_days(1)};
+  // Azure does not allow '/' in table, partition or row names
+  const string key {data_table.name() + '/' + partition + '/' + row + '/' +
+                    std::to_string(permissions) + '/' + signing_key_id(data_table)};
+  const auto now = std::chrono::steady_clock::now();
+  {
+    scoped_critical_section_t lock {issued_tokens_lock};
+    auto issued (issued_tokens.find(key));
+    if (issued != issued_tokens.end()) {
+      if (issued->second.expires - now > token_refresh_margin) {
+        issued_tokens_lru.splice(issued_tokens_lru.begin(), issued_tokens_lru,
+                                 issued->second.position);
+        return make_pair(status_codes::OK, issued->second.token);
+      }
+      erase_issued_token(issued);
+    }
+  }
+
+  utility::datetime exptime {utility::datetime::utc_now() +
+                             utility::datetime::from_hours(token_lifetime.count())};
   try {
     string limited_access_token {
       data_table.get_shared_access_signature(table_shared_access_policy {
@@ -186,7 +477,17 @@ pair<status_code,string> do_get_token (const cloud_table& data_table,
         // Following token allows read access to entire table
         //table.get_shared_access_signature(table_shared_access_policy {exptime, permissions})
       };
-    cout << "Token " << limited_access_token << endl;
+
+    // A concurrent miss on the same key just replaces this token
+    scoped_critical_section_t lock {issued_tokens_lock};
+    auto issued (issued_tokens.find(key));
+    if (issued != issued_tokens.end())
+      erase_issued_token(issued);
+    while (issued_tokens.size() >= issued_tokens_capacity)
+      erase_issued_token(issued_tokens.find(issued_tokens_lru.back()));
+    issued_tokens_lru.push_front(key);
+    issued_tokens.emplace(key, issued_token_t {limited_access_token, now + token_lifetime,
+                                               issued_tokens_lru.begin()});
     return make_pair(status_codes::OK, limited_access_token);
   }
   catch (const storage_exception& e) {
@@ -197,141 +498,32 @@ pair<status_code,string> do_get_token (const cloud_table& data_table,
 }
 
 /*
-  Top-level routine for processing all HTTP GET requests.
-
-  HTTP URL for this server is defined in this file as http://localhost:34570.
-
-  Possible operations:
-
-    Operation name:
-      GetReadToken
-    Operation:
-      Returns a JSON object with a single property named "token", with the
-      value of a string which is the authentication token from Microsoft Azure.
-      The authentication token allows for read operations ONLY.
-    Body:
-      JSON object with a single property named "Password", with the value of
-      a string which is the password for the user ID provided in the URI.
-    URI:
-      http://localhost:34570/GetReadToken/USER_ID
-
-  TODO: GetUpdateToken has not been implemented yet.
+  Reply to message, a GetReadToken, GetUpdateToken or GetUpdateData
+  request (operation), once the credentials of its user have been
+  read into found.
  */
-void handle_get(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** AuthServer GET " << path << endl;
-  auto paths = uri::split_path(path);
-  // Need at least an operation and userid
-  if (paths.size() < 2) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  // [0] refers to the operation name
-  // Evaluated after size() to ensure legitimate access
-  else if(paths[0] != get_read_token_op && paths[0] != get_update_token_op && paths[0] != get_update_data_op ) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  else if(!has_json_body(message)) {
-    message.reply(status_codes::BadRequest);
+void reply_with_token(http_request message, const string& operation,
+                      const credentials_result_t& found, const string& password_given) {
+  if(found.first != status_codes::OK) {
+    // User ID not found, or storage failed
+    message.reply(found.first);
     return;
   }
 
-  unordered_map<string, string> json_body {get_json_bourne(message)};
-  unordered_map<string, string>::const_iterator json_body_password_iterator
-    {json_body.find("Password")};
-
-  if(json_body.size() != 1) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  // No 'Password' property
-  else if(json_body_password_iterator == json_body.end()) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-
-  const string userid = paths[1];
-  const string password_given = json_body_password_iterator->second;
-  string password_actual;
   string authenticated_partition;
   string authenticated_row;
-
-  if(password_given.empty()) {
-    message.reply(status_codes::BadRequest);
-  }
-
-  cloud_table table {table_cache.lookup_table(auth_table_name)};
-  if(!table.exists()) {
-    message.reply(status_codes::InternalError);
+  status_code authenticated {
+    authenticate(found.second, password_given, authenticated_partition, authenticated_row)};
+  if(authenticated != status_codes::OK) {
+    message.reply(authenticated);
     return;
   }
 
-  // Search through the table AuthTable, partition Userid
-  table_query query {};
-  query.set_filter_string( table_query::combine_filter_conditions(
-    table_query::generate_filter_condition(
-      U("PartitionKey"),
-      query_comparison_operator::equal,
-      U("Userid")
-    ),
-    query_logical_operator::op_and,
-    table_query::generate_filter_condition(
-      U("RowKey"),
-      query_comparison_operator::equal,
-      U(userid)
-    )
-  ));
-  table_query_iterator end;
-  table_query_iterator it = table.execute_query(query);
-  if(it == end) {
-    // User ID not found
-    message.reply(status_codes::NotFound);
-    return;
-  }
-
-  prop_str_vals_t properties = get_string_properties(it->properties());
-  for(auto p : properties) {
-    string property_name = p.first;
-    if(property_name == auth_table_password_prop) {
-      password_actual = p.second;
-    }
-    else if(property_name == auth_table_partition_prop) {
-      authenticated_partition = p.second;
-    }
-    else if(property_name == auth_table_row_prop) {
-      authenticated_row = p.second;
-    }
-    else {
-      // Invalid property
-      message.reply(status_codes::InternalError);
-      return;
-    }
-  }
-
-  if( password_actual.empty() ||
-      authenticated_partition.empty() ||
-      authenticated_row.empty() ) {
-    // At least one of the necessary properties not found
-    message.reply(status_codes::InternalError);
-    return;
-  }
-  else if(password_given != password_actual) {
-    // Incorrect Password
-    // Same status code as incorrect user ID for security purposes
-    message.reply(status_codes::NotFound);
-    return;
-  }
-
-  table = table_cache.lookup_table(data_table_name);
-  if(!table.exists()) {
-    message.reply(status_codes::InternalError);
-    return;
-  }
+  cloud_table table {table_cache.lookup_table(data_table_name)};
 
   // get a read or read|update token
   pair<status_code, string> result;
-  if(paths[0] == get_read_token_op ) {
+  if(operation == get_read_token_op ) {
   result = do_get_token
   (
     table,
@@ -352,10 +544,10 @@ void handle_get(http_request message) {
 
   if(result.first == status_codes::OK) {
     vector<pair<string, value>> json_token;
-    if ( paths[0] == get_update_token_op || paths[0] == get_read_token_op ){
+    if ( operation == get_update_token_op || operation == get_read_token_op ){
       json_token.push_back( make_pair("token", value::string(result.second)));
     }
-    if ( paths[0] == get_update_data_op ){
+    if ( operation == get_update_data_op ){
       json_token.push_back( make_pair("token", value::string(result.second)) );
       json_token.push_back( make_pair("DataPartition", value::string(authenticated_partition)) );
       json_token.push_back( make_pair("DataRow", value::string(authenticated_row)) );
@@ -375,6 +567,214 @@ void handle_get(http_request message) {
     return;
   }
 }
+
+/*
+  Top-level routine for processing HTTP GET requests, dispatched
+  by operation name through the GET router set up in main().
+
+  HTTP URL for this server is defined in this file as http://localhost:34570.
+
+  Possible operations:
+
+    Operation name:
+      GetReadToken
+    Operation:
+      Returns a JSON object with a single property named "token", with the
+      value of a string which is the authentication token from Microsoft Azure.
+      The authentication token allows for read operations ONLY.
+    Body:
+      JSON object with a single property named "Password", with the value of
+      a string which is the password for the user ID provided in the URI.
+    URI:
+      http://localhost:34570/GetReadToken/USER_ID
+
+  The body, the table checks and the read of AuthTable all complete
+  in continuations, so no listener thread waits on the client or on
+  Azure.
+
+  TODO: GetUpdateToken has not been implemented yet.
+ */
+void handle_get_token(http_request message, const vector<string>& paths) {
+  if(!has_json_body(message)) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+
+  const string operation {paths[0]};
+  const string userid {paths[1]};
+  with_json_body(message, [message, operation, userid] (const unordered_map<string,string>& json_body)
+    {
+      unordered_map<string, string>::const_iterator json_body_password_iterator
+        {json_body.find("Password")};
+
+      if(json_body.size() != 1) {
+        message.reply(status_codes::BadRequest);
+        return;
+      }
+      // No 'Password' property
+      else if(json_body_password_iterator == json_body.end()) {
+        message.reply(status_codes::BadRequest);
+        return;
+      }
+
+      const string password_given = json_body_password_iterator->second;
+      if(password_given.empty()) {
+        message.reply(status_codes::BadRequest);
+        return;
+      }
+
+      if_tables_exist(message, [message, operation, userid, password_given] ()
+        {
+          // Read the user's entity in AuthTable, partition Userid
+          read_credentials(table_cache.lookup_table(auth_table_name), userid)
+            .then([message, operation, password_given] (credentials_result_t found)
+                  {
+                    reply_with_token(message, operation, found, password_given);
+                  });
+        });
+    });
+}
+
+/*
+  Carry out a GetUpdateDataBulk request, once its body has arrived and
+  both tables are known to exist. passwords holds the body.
+ */
+void issue_bulk_tokens(http_request message,
+                       std::shared_ptr<unordered_map<string,string>> passwords) {
+  cloud_table data_table {table_cache.lookup_table(data_table_name)};
+
+  auto state (std::make_shared<bulk_read_t>());
+  state->table = table_cache.lookup_table(auth_table_name);
+  state->userids.reserve(passwords->size());
+  for(const auto& user : *passwords) {
+    state->userids.push_back(user.first);
+  }
+  state->batch_count = (state->userids.size() + bulk_read_batch_size - 1) / bulk_read_batch_size;
+
+  vector<pplx::task<void>> workers {};
+  for(std::size_t w {0}; w < std::min(bulk_read_parallelism, state->batch_count); ++w) {
+    workers.push_back(read_credentials_worker(state));
+  }
+
+  pplx::when_all(workers.begin(), workers.end())
+    .then([message, passwords, data_table, state] (pplx::task<void> reads) {
+        try {
+          reads.get();
+        }
+        catch (const storage_exception& e) {
+          cout << "Azure Table Storage error: " << e.what() << endl;
+          message.reply(status_codes::InternalError);
+          return;
+        }
+        catch (const std::exception& e) {
+          cout << e.what() << endl;
+          message.reply(status_codes::InternalError);
+          return;
+        }
+        const unordered_map<string,table_entity>& found (state->found);
+
+        vector<pair<string,value>> results {};
+        results.reserve(passwords->size());
+        for(const auto& user : *passwords) {
+          status_code status {status_codes::NotFound};
+          string partition;
+          string row;
+          pair<status_code,string> token;
+          auto credentials (found.find(user.first));
+          if(user.second.empty()) {
+            status = status_codes::BadRequest;
+          }
+          else if(credentials != found.end()) {
+            status = authenticate(credentials->second, user.second, partition, row);
+          }
+          if(status == status_codes::OK) {
+            token = do_get_token(data_table, partition, row,
+                                 table_shared_access_policy::permissions::read |
+                                 table_shared_access_policy::permissions::update);
+            status = token.first;
+          }
+
+          vector<pair<string,value>> fields {make_pair("Status", value::number(static_cast<int>(status)))};
+          if(status == status_codes::OK) {
+            fields.push_back(make_pair("token", value::string(token.second)));
+            fields.push_back(make_pair("DataPartition", value::string(partition)));
+            fields.push_back(make_pair("DataRow", value::string(row)));
+          }
+          results.push_back(make_pair(user.first, value::object(fields)));
+        }
+        message.reply(status_codes::OK, value::object(results));
+      });
+}
+
+/*
+  Issue update tokens for many users in one request.
+
+  HTTP URL for this server is defined in this file as http://localhost:34570.
+
+    Operation name:
+      GetUpdateDataBulk
+    Operation:
+      Returns a JSON object with a property for each user ID in the body.
+      Its value is an object with a property "Status", the status code
+      GetUpdateData would have returned for that user. If the status is
+      OK (200), the object also has the properties "token", "DataPartition"
+      and "DataRow", as returned by GetUpdateData.
+    Body:
+      JSON object with a property for each user, named by the user ID,
+      with the value of a string which is the user's password.
+    URI:
+      http://localhost:34570/GetUpdateDataBulk
+
+  The request itself fails with BadRequest if there is no body, the body
+  is empty or it names more than bulk_max_users users.
+
+  Credentials are read in batches by up to bulk_read_parallelism
+  workers, each taking the next unread batch until none are left.
+  The body, the table checks and the reads all complete in
+  continuations, so no listener thread waits on the client or on
+  Azure.
+ */
+void handle_get_update_data_bulk(http_request message, const vector<string>& paths) {
+  if(!has_json_body(message)) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+
+  with_json_body(message, [message] (const unordered_map<string,string>& json_body)
+    {
+      if(json_body.empty() || json_body.size() > bulk_max_users) {
+        message.reply(status_codes::BadRequest);
+        return;
+      }
+
+      auto passwords (std::make_shared<unordered_map<string,string>>(json_body));
+      if_tables_exist(message, [message, passwords] ()
+        {
+          issue_bulk_tokens(message, passwords);
+        });
+    });
+}
+
+/*
+  Drop the cached credentials of a user.
+
+  HTTP URL for this server is defined in this file as http://localhost:34570.
+
+    Operation name:
+      InvalidateCredentialsAdmin
+    Operation:
+      Removes USER_ID from the credential cache, so that the next token
+      request for the user reads AuthTable. Call it after changing the
+      user's entry in AuthTable. Replies OK whether or not the user was
+      cached.
+    URI:
+      http://localhost:34570/InvalidateCredentialsAdmin/USER_ID
+ */
+void handle_invalidate_credentials(http_request message, const vector<string>& paths) {
+  credential_cache.invalidate(auth_table_name, auth_table_userid_partition, paths[1]);
+  message.reply(status_codes::OK);
+}
+
 /*
 void get_update_data_print(string partition, string row){
   cout << "Partition" << partition << endl;
@@ -406,33 +806,72 @@ void handle_delete(http_request message) {
 }
 
 /*
-  Main authentication server routine
+  Start the authentication server
 
-  Install handlers for the HTTP requests and open the listener,
-  which processes each request asynchronously.
+  Register the handler for each operation, with the number of
+  path segments it takes, in service.
 
   Note that, unlike BasicServer, AuthServer only
-  installs the listeners for GET. Any other HTTP
+  registers routes for GET, plus the DELETE of
+  InvalidateCredentialsAdmin. Any other HTTP
   method will produce a Method Not Allowed (405)
   response.
 
-  If you want to support other methods, uncomment
-  the call below that hooks in a the appropriate
-  listener.
+  AuthServer takes no arguments.
+ */
+void start (Service& service, const vector<string>&) {
+  cout << "AuthServer: Parsing connection string" << endl;
+  table_cache.init (storage_connection_string, table_recheck_interval);
+
+  std::size_t warmed {table_cache.warm_up(vector<string> {auth_table_name, data_table_name})};
+  cout << "AuthServer: Warmed up " << warmed << " tables" << endl;
+
+  Router& get_routes (service.routes(methods::GET));
+  get_routes.add(get_read_token_op, 2, &handle_get_token);
+  get_routes.add(get_update_token_op, 2, &handle_get_token);
+  get_routes.add(get_update_data_op, 2, &handle_get_token);
+  get_routes.add(get_update_data_bulk_op, 1, &handle_get_update_data_bulk);
+
+  Router& delete_routes (service.routes(methods::DEL));
+  delete_routes.add(invalidate_credentials_op, 2, &handle_invalidate_credentials);
+}
+
+/*
+  Report on the authentication server once its listener has closed
+ */
+void stop () {
+  const unsigned long long hits {credential_cache.hits()};
+  const unsigned long long lookups {hits + credential_cache.misses()};
+  cout << "AuthServer: Credential cache hits " << hits
+       << ", misses " << credential_cache.misses();
+  if (lookups > 0)
+    cout << " (hit rate " << 100.0 * hits / lookups << "%)";
+  cout << endl;
+}
+
+}
+
+#ifndef COMBINED_SERVERS
+/*
+  Main authentication server routine
+
+  Start the server and open the listener, which processes
+  each request asynchronously.
 
   Wait for a carriage return, then shut the server down.
  */
 int main (int argc, char const * argv[]) {
-  cout << "AuthServer: Parsing connection string" << endl;
-  table_cache.init (storage_connection_string);
+  const auto started = std::chrono::steady_clock::now();
+  Service service {};
+  auth_service::start(service, vector<string> (argv + 1, argv + argc));
 
   cout << "AuthServer: Opening listener" << endl;
   http_listener listener {server_urls::auth_server};
-  listener.support(methods::GET, &handle_get);
-  //listener.support(methods::POST, &handle_post);
-  //listener.support(methods::PUT, &handle_put);
-  //listener.support(methods::DEL, &handle_delete);
+  service.support(listener);
   listener.open().wait(); // Wait for listener to complete starting
+  cout << "AuthServer: Ready after "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()
+       << " ms" << endl;
 
   cout << "Enter carriage return to stop AuthServer." << endl;
   string line;
@@ -440,5 +879,7 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  auth_service::stop();
   cout << "AuthServer closed" << endl;
 }
+#endif
@@ -8,8 +8,11 @@
   http://localhost:34568.
 */
 
+#include <algorithm>
+#include <chrono>
 #include <exception>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -21,6 +24,7 @@
 #include <cpprest/base_uri.h>
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
+#include <cpprest/producerconsumerstream.h>
 
 #include <pplx/pplxtasks.h>
 
@@ -28,9 +32,15 @@
 #include <was/storage_account.h>
 #include <was/table.h>
 
+#include "../include/CpprestInternals.h"
+#include "../include/EntityCache.h"
+#include "../include/JsonBody.h"
 #include "../include/make_unique.h"
+#include "../include/Router.h"
 #include "../include/ServerUrls.h"
 #include "../include/ServerUtils.h"
+#include "../include/Services.h"
+#include "../include/Settings.h"
 #include "../include/TableCache.h"
 
 #include "../include/azure_keys.h"
@@ -39,16 +49,22 @@
 using azure::storage::cloud_storage_account;
 using azure::storage::cloud_table;
 using azure::storage::cloud_table_client;
+using azure::storage::continuation_token;
 using azure::storage::storage_credentials;
 using azure::storage::storage_exception;
 using azure::storage::edm_type;
 using azure::storage::entity_property;
+using azure::storage::query_comparison_operator;
+using azure::storage::query_logical_operator;
+using azure::storage::table_batch_operation;
 using azure::storage::table_entity;
 using azure::storage::table_operation;
 using azure::storage::table_query;
-using azure::storage::table_query_iterator;
+using azure::storage::table_query_segment;
 using azure::storage::table_result;
 
+using concurrency::streams::producer_consumer_buffer;
+
 using pplx::extensibility::critical_section_t;
 using pplx::extensibility::scoped_critical_section_t;
 
@@ -64,6 +80,7 @@ using std::vector;
 
 using web::http::http_headers;
 using web::http::http_request;
+using web::http::http_response;
 using web::http::methods;
 using web::http::status_code;
 using web::http::status_codes;
@@ -73,38 +90,7 @@ using web::json::value;
 
 using web::http::experimental::listener::http_listener;
 
-using prop_vals_t = vector<pair<string,value>>;
-
-/*
-  Convert properties represented in Azure Storage type
-  to prop_vals_t type.
- */
-prop_vals_t get_properties (const table_entity::properties_type& properties, prop_vals_t values = prop_vals_t {});
-
-/*
-  Return true if an HTTP request has a JSON body
-
-  This routine can be called multiple times on the same message.
- */
-bool has_json_body (http_request message);
-
-/*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-  get_json_body and get_json_bourne are valid and identical function calls.
-
-  If the message has no JSON body, return an empty map.
-
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
-
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
- */
-unordered_map<string,string> get_json_body(http_request message);
-unordered_map<string,string> get_json_bourne(http_request message);
+namespace basic_service {
 
 // Unnamed namespace for local functions and structures
 namespace {
@@ -118,6 +104,11 @@ struct get_request_t {
   unsigned int paths_count {};
 };
 
+struct page_request_t {
+  int size {};
+  continuation_token token {};
+};
+
 //Unauthorized Options
 const string create_table {"CreateTable"};
 const string delete_table {"DeleteTable"};
@@ -129,11 +120,15 @@ const string create_table_op {"CreateTableAdmin"};
 const string delete_table_op {"DeleteTableAdmin"};
 
 const string read_entity_admin {"ReadEntityAdmin"};
+const string read_entities_admin {"ReadEntitiesAdmin"};
 const string update_entity_admin {"UpdateEntityAdmin"};
+const string update_entities_admin {"UpdateEntitiesAdmin"};
 const string delete_entity_admin {"DeleteEntityAdmin"};
 
 const string read_entity_auth {"ReadEntityAuth"};
 const string update_entity_auth {"UpdateEntityAuth"};
+const string append_list_item_auth {"AppendListItemAuth"};
+const string remove_list_item_auth {"RemoveListItemAuth"};
 
 const string get_read_token_op  {"GetReadToken"};
 const string get_update_token_op {"GetUpdateToken"};
@@ -142,12 +137,63 @@ const string get_update_token_op {"GetUpdateToken"};
 const string add_property_admin {"AddPropertyAdmin"};
 const string update_property_admin {"UpdatePropertyAdmin"};
 
-// Cache of opened tables
+// Query parameters and response header for paged table/partition reads
+const string page_size_param {"pagesize"};
+const string continuation_param {"continuation"};
+const string continuation_header {"Continuation-Token"};
+
+// Largest page that Azure will return in a single segment
+constexpr int max_page_size {1000};
+
+// Most operations Azure allows in one entity group transaction
+constexpr std::size_t max_batch_size {100};
+// Most entity group transactions run at once by UpdateEntitiesAdmin
+constexpr std::size_t max_concurrent_batches {16};
+
+// Most point reads run at once by ReadEntitiesAdmin
+constexpr std::size_t max_concurrent_reads {32};
+
+/*
+  A streamed read waits, before reading its next segment, until the
+  client has taken all but body_high_water bytes of the body, checking
+  every body_drain_poll_interval. A client that reads nothing for
+  BODY_STALL_TIMEOUT seconds (from the environment, by default
+  default_body_stall_timeout) has its body closed unfinished.
+ */
+constexpr std::size_t body_high_water {256 * 1024};
+constexpr std::chrono::milliseconds body_drain_poll_interval {10};
+constexpr std::chrono::seconds default_body_stall_timeout {60};
+const std::chrono::steady_clock::duration body_stall_timeout {
+  env_seconds("BODY_STALL_TIMEOUT", default_body_stall_timeout)
+};
+
+/*
+  Cache of opened tables, rechecking existing tables every minute.
+
+  A table deleted through this server is forgotten at once, but one
+  deleted by another process is still reported as existing until its
+  recheck completes: for up to table_recheck_interval, plus the time
+  the recheck takes. Requests on it in that window get the error Azure
+  returns for a missing table rather than NotFound.
+ */
+constexpr std::chrono::seconds table_recheck_interval {60};
 TableCache table_cache {};
 
 /*
-  This local function returns the contents of the GET request in a
-  get_request_t variable.
+  Cache of entities read by ReadEntityAdmin. The capacity and the time
+  an entry stays valid can be set with the environment variables
+  ENTITY_CACHE_CAPACITY and ENTITY_CACHE_TTL (in seconds).
+ */
+constexpr std::size_t default_entity_cache_capacity {10000};
+constexpr std::chrono::seconds default_entity_cache_ttl {60};
+EntityCache entity_cache {
+  env_size("ENTITY_CACHE_CAPACITY", default_entity_cache_capacity),
+  env_seconds("ENTITY_CACHE_TTL", default_entity_cache_ttl)
+};
+
+/*
+  This local function returns the contents of the GET request with the
+  given (decoded) path segments in a get_request_t variable.
   The returned request parameters are not guaranteed to be valid for the table.
 
   An exception will be thrown if:
@@ -155,11 +201,7 @@ TableCache table_cache {};
     The request is incorrectly formed in terms of the number of paths
       (see documentation for handle_get) (invalid_argument)
  */
-get_request_t parse_get_request_paths(http_request message) {
-  // string path { uri::decode(message.relative_uri().path()) };
-  string path = message.relative_uri().path();
-  auto paths = uri::split_path(path);
-
+get_request_t parse_get_request_paths(const vector<string>& paths) {
   get_request_t req;
   req.paths_count = paths.size();
 
@@ -206,40 +248,112 @@ get_request_t parse_get_request_paths(http_request message) {
 }
 
 /*
-  This local function returns a vector of JSON objects.
-  If the JSON body has no elements, then the vector will contain all
+  This local function returns the paging parameters of a GET request,
+  taken from its query string:
+    pagesize: Maximum number of entities to return (1 to 1000)
+    continuation: Token returned in the Continuation-Token header of the
+      previous page
+
+  If no page size is given, the returned size is 0, meaning the whole
+  result is wanted in one response.
+
+  The continuation token is the hex encoding of the Azure next marker,
+  so that it can be passed back in a query string without escaping.
+
+  An exception will be thrown if:
+    The page size is not a number from 1 to 1000 (invalid_argument)
+    A continuation is given without a page size (invalid_argument)
+    The continuation is not a valid token (invalid_argument)
+ */
+page_request_t parse_page_request(http_request message) {
+  auto params = uri::split_query(message.relative_uri().query());
+  page_request_t page;
+
+  auto size_param = params.find(page_size_param);
+  if (size_param != params.end()) {
+    const string size_string {uri::decode(size_param->second)};
+    if (size_string.empty() ||
+        size_string.find_first_not_of("0123456789") != string::npos ||
+        size_string.size() > 4) {
+      throw std::invalid_argument ("Error: parse_page_request() was "\
+        "given an invalid page size.\n");
+    }
+    page.size = std::stoi(size_string);
+    if (page.size < 1 || page.size > max_page_size) {
+      throw std::invalid_argument ("Error: parse_page_request() was "\
+        "given an invalid page size.\n");
+    }
+  }
+
+  auto token_param = params.find(continuation_param);
+  if (token_param != params.end()) {
+    const string hex {uri::decode(token_param->second)};
+    if (page.size == 0 || hex.size() % 2 != 0 ||
+        hex.find_first_not_of("0123456789abcdef") != string::npos) {
+      throw std::invalid_argument ("Error: parse_page_request() was "\
+        "given an invalid continuation token.\n");
+    }
+    string marker {};
+    for (string::size_type i {0}; i < hex.size(); i += 2) {
+      marker += static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16));
+    }
+    page.token = continuation_token {marker};
+  }
+
+  return page;
+}
+
+/*
+  This local function returns the opaque form of a continuation token,
+  as described for parse_page_request().
+ */
+string encode_continuation(const continuation_token& token) {
+  static const char digits[] {"0123456789abcdef"};
+  const string& marker = token.next_marker();
+  string hex {};
+  hex.reserve(2 * marker.size());
+  for (const unsigned char c : marker) {
+    hex += digits[c >> 4];
+    hex += digits[c & 0xf];
+  }
+  return hex;
+}
+
+/*
+  This local function returns a query over the entities of a table.
+  If the JSON body has no elements, then the query will return all
   entities in the table.
-  If the JSON body has elements, then the vector will contain all
+  If the JSON body has elements, then the query will return all
   entities in the table which have all of the properties in the JSON body
-  (regardless of value).
-  Each element in the vector is a single entity.
+  (regardless of value), and each entity will only contain the requested
+  properties.
+
+  The property filter is pushed down into the storage query as a
+  "PROPERTY ge ''" condition per property, with the requested properties
+  as the column projection, so entities that do not match are never sent
+  by Azure. As every property written by this server is a string, this
+  matches any entity which has the property.
 
   JSON body:
     JSON object where the name is the property name and the value is "*".
     E.g. {"born":"*", "art":"*"} would return all entities in the requested
     table which have properties "born" and "art".
 
+  The caller must already have checked that the table exists.
+
   An exception is thrown if:
     The operation is incorrect or nonexistent (invalid_argument)
-    The table name is incorrect or nonexistent (invalid_argument)
     Not all elements in the JSON body have the value "*" (invalid_argument)
  */
-vector<value> get_table_or_properties(get_request_t request,
-                                      unordered_map<string, string> json_body) {
+table_query get_table_or_properties(get_request_t request,
+                                    unordered_map<string, string> json_body) {
 
   if (request.operation != read_entity_admin) {
     throw std::invalid_argument ("Error: get_table_or_properties() was "\
       "given an invalid operation.\n");
   }
 
-  // Check for specified table
-  cloud_table table {table_cache.lookup_table(request.table)};
-  if ( !table.exists() ) {
-    throw std::invalid_argument ("Error: get_table_or_properties() was "\
-      "given an invalid table name.\n");
-  }
-
-  for(const auto v : json_body){
+  for(const auto& v : json_body){
     if(v.second != "*"){
       throw std::invalid_argument ("Error: get_table_or_properties() was "\
         "given a JSON body which had at least one element with a value "\
@@ -247,71 +361,55 @@ vector<value> get_table_or_properties(get_request_t request,
     }
   }
 
-  // Creating vector for all properties to loop through later
+  // Only ask Azure for entities which have every requested property,
+  // and only for the requested properties of those entities
   table_query query {};
-  table_query_iterator end;
-  table_query_iterator it = table.execute_query(query);
-  vector<value> entities;
-
-  while (it != end) {
-    cout << "Key: " << it->partition_key() << " / " << it->row_key() << endl;
-
-    prop_vals_t entity {
-      make_pair("Partition",value::string( it->partition_key() )),
-      make_pair("Row", value::string( it->row_key() ))
-    };
-    entity = get_properties(it->properties(), entity);
-
-    if(json_body.size() == 0) {
-      entities.push_back(value::object(entity));
-    }
-    else {
-      bool found_all_properties = true;
-      for(const auto desired_property : json_body) {
-        bool found_property = false;
-        for(const auto p : entity) {
-          if(desired_property.first == p.first) {
-            found_property = true;
-          }
-        }
-        if(!found_property) {
-          found_all_properties = false;
-        }
+  if (json_body.size() > 0) {
+    string filter {};
+    vector<string> columns {};
+    for (const auto& desired_property : json_body) {
+      string condition {
+        table_query::generate_filter_condition(
+          desired_property.first,
+          query_comparison_operator::greater_than_or_equal,
+          string {}
+        )
+      };
+      if (filter.empty()) {
+        filter = condition;
       }
-
-      if(found_all_properties) {
-        entities.push_back(value::object(entity));
+      else {
+        filter = table_query::combine_filter_conditions(
+          filter,
+          query_logical_operator::op_and,
+          condition
+        );
       }
+      columns.push_back(desired_property.first);
     }
-
-    ++it;
+    query.set_filter_string(filter);
+    query.set_select_columns(columns);
   }
 
-  return entities;
+  return query;
 }
 
 /*
-  This local function returns a vector of JSON objects with all entities in a
-  requested partition. Each element is a single entity.
+  This local function returns a query over all entities in a
+  requested partition.
+
+  The caller must already have checked that the table exists.
 
   An exception is thrown if:
     The operation is incorrect or nonexistent (invalid_argument)
-    The table name is incorrect or nonexistent (invalid_argument)
     The row name is not "*" (logic_error)
  */
-vector<value> get_partition(get_request_t request) {
+table_query get_partition(get_request_t request) {
   if (request.operation != read_entity_admin) {
     throw std::invalid_argument ("Error: get_partition() was given an "\
       "invalid operation.\n");
   }
 
-  // Check for specified table
-  cloud_table table {table_cache.lookup_table(request.table)};
-  if ( !table.exists() ) {
-    throw std::invalid_argument ("Error: get_partition() was given an "\
-      "invalid table name.\n");
-  }
-
   // Placed here for logical order - operation, table, row
   if (request.row != "*") {
     throw std::logic_error ("Error: get_partition() was given an "\
@@ -320,7 +418,6 @@ vector<value> get_partition(get_request_t request) {
 
   // Create Query
   table_query query {};
-  table_query_iterator end;
   query.set_filter_string(
     azure::storage::table_query::generate_filter_condition(
       "PartitionKey",
@@ -328,52 +425,363 @@ vector<value> get_partition(get_request_t request) {
       request.partition
     )
   );
-  table_query_iterator it = table.execute_query(query);
+  return query;
+}
 
-  // Parse into vector
-  vector<value> entity_vec;
-  while (it != end) {
-    cout << "Key: " << it->partition_key() << " / " << it->row_key() << endl;
+/*
+  This local function appends s to out as a quoted JSON string.
+ */
+void append_json_string(string& out, const string& s) {
+  static const char hex_digits[] {"0123456789abcdef"};
+  out += '"';
+  for (const char c : s) {
+    switch (c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          out += "\\u00";
+          out += hex_digits[(c >> 4) & 0xf];
+          out += hex_digits[c & 0xf];
+        }
+        else {
+          out += c;
+        }
+    }
+  }
+  out += '"';
+}
 
-    prop_vals_t entity {
-      make_pair( "Partition", value::string(it->partition_key()) ),
-      make_pair( "Row", value::string(it->row_key()) )
-    };
-    entity = get_properties(it->properties(), entity);
-    entity_vec.push_back(value::object(entity));
-    ++it;
+/*
+  This local function appends the property named name to out as a
+  JSON object member. Numbers and booleans keep their JSON type;
+  strings, datetimes and any other type are written as strings.
+ */
+void append_property_json(string& out, const string& name, const entity_property& property) {
+  append_json_string(out, name);
+  out += ':';
+  switch (property.property_type()) {
+    case edm_type::string:
+      append_json_string(out, property.string_value());
+      break;
+    case edm_type::int32:
+      out += std::to_string(property.int32_value());
+      break;
+    case edm_type::int64:
+      out += std::to_string(property.int64_value());
+      break;
+    case edm_type::double_floating_point:
+      out += value::number(property.double_value()).serialize();
+      break;
+    case edm_type::boolean:
+      out += property.boolean_value() ? "true" : "false";
+      break;
+    default:
+      // Datetimes and any other type as their string form
+      append_json_string(out, property.str());
+  }
+}
+
+/*
+  This local function appends properties to out as a JSON object.
+ */
+void append_properties_json(string& out, const table_entity::properties_type& properties) {
+  out += '{';
+  bool first {true};
+  for (const auto& p : properties) {
+    if ( ! first)
+      out += ',';
+    first = false;
+    append_property_json(out, p.first, p.second);
+  }
+  out += '}';
+}
+
+/*
+  This local function appends entity to out as a JSON object holding
+  its partition and row names, as the properties "Partition" and "Row",
+  followed by its properties.
+
+  Writing straight into out avoids building a json::value for each
+  entity; out can be reused across entities.
+ */
+void append_entity_json(string& out, const table_entity& entity) {
+  out += "{\"Partition\":";
+  append_json_string(out, entity.partition_key());
+  out += ",\"Row\":";
+  append_json_string(out, entity.row_key());
+  for (const auto& p : entity.properties()) {
+    out += ',';
+    append_property_json(out, p.first, p.second);
+  }
+  out += '}';
+}
+
+/*
+  This local function writes s to body, keeping s alive until the
+  write completes.
+ */
+pplx::task<void> write_string(producer_consumer_buffer<uint8_t> body, string s) {
+  if (s.empty())
+    return pplx::task_from_result();
+  auto data = std::make_shared<string>(std::move(s));
+  return body.putn_nocopy(reinterpret_cast<const uint8_t*>(data->data()), data->size())
+    .then([data] (std::size_t) {});
+}
+
+/*
+  This local function returns a task that completes once the client
+  has read body down to body_high_water unread bytes. unread is the
+  number of unread bytes when the client last made progress, at
+  last_read.
+
+  A producer_consumer_buffer accepts every write at once and has no
+  way to signal a read, so the buffer is checked with after_delay();
+  no thread waits between checks. The task fails if the client has
+  gone away and the body can no longer be read, or if the client has
+  read nothing for body_stall_timeout. In the latter case the reading
+  side of body is closed first, so the listener stops sending it and
+  the unread bytes are freed.
+ */
+pplx::task<void> wait_for_drain(producer_consumer_buffer<uint8_t> body,
+                                std::size_t unread,
+                                std::chrono::steady_clock::time_point last_read) {
+  if ( ! body.can_read())
+    return pplx::task_from_exception<void>(std::runtime_error {"Client stopped reading the body"});
+  const std::size_t available {body.in_avail()};
+  if (available <= body_high_water)
+    return pplx::task_from_result();
+
+  const auto now = std::chrono::steady_clock::now();
+  if (available < unread) {
+    unread = available;
+    last_read = now;
+  }
+  else if (now - last_read >= body_stall_timeout) {
+    return body.close(std::ios_base::in)
+      .then([] ()
+            {
+              throw std::runtime_error {"Client stalled reading the body"};
+            });
+  }
+
+  return after_delay(body_drain_poll_interval)
+    .then([body, unread, last_read] ()
+          {
+            return wait_for_drain(body, unread, last_read);
+          });
+}
+
+// This local function starts wait_for_drain() from the current state of body
+pplx::task<void> wait_for_drain(producer_consumer_buffer<uint8_t> body) {
+  return wait_for_drain(body, body.in_avail(), std::chrono::steady_clock::now());
+}
+
+/*
+  This local function writes the entities of query to body as JSON
+  objects separated by commas, starting from the segment at token.
+  first is true if no entity has been written to body yet.
+
+  Each segment is read with execute_query_segmented_async() and
+  written, and the next segment is not requested until the client
+  has read the body down to body_high_water bytes. So at most one
+  segment, plus body_high_water bytes of the body, is held in memory
+  however slowly the client reads, and no thread waits on Azure or
+  on the client.
+ */
+pplx::task<void> write_segments(cloud_table table, table_query query,
+                                continuation_token token,
+                                producer_consumer_buffer<uint8_t> body,
+                                bool first) {
+  return table.execute_query_segmented_async(query, token)
+    .then([table, query, body, first] (table_query_segment segment) -> pplx::task<void>
+          {
+            string chunk {};
+            bool none_written {first};
+            for (const auto& e : segment.results()) {
+              cout << "Key: " << e.partition_key() << " / " << e.row_key() << endl;
+
+              if ( ! none_written)
+                chunk += ',';
+              append_entity_json(chunk, e);
+              none_written = false;
+            }
+
+            const continuation_token next {segment.continuation_token()};
+            return write_string(body, std::move(chunk))
+              .then([table, query, body, none_written, next] () -> pplx::task<void>
+                    {
+                      if (next.empty())
+                        return pplx::task_from_result();
+                      return wait_for_drain(body)
+                        .then([table, query, body, none_written, next] ()
+                              {
+                                return write_segments(table, query, next, body, none_written);
+                              });
+                    });
+          });
+}
+
+/*
+  This local function replies to message with status OK and a JSON array
+  of objects, one per entity returned by query. Each object holds the
+  properties of the entity, plus its partition and row names as the
+  properties "Partition" and "Row".
+
+  The reply is sent with a chunked body before the first entity is read,
+  and each segment of entities is serialized straight into the body as
+  it arrives, no faster than the client reads it (see write_segments()),
+  so the result set is never held in memory as a whole. The function
+  returns at once; the body is written by continuations.
+
+  As the status code has already been sent, an error from Azure (or any
+  other error) partway through is only logged, and the body is closed
+  without its closing ']' so that the client cannot mistake it for a
+  complete result.
+ */
+void reply_with_entities(http_request message, cloud_table table, table_query query) {
+  producer_consumer_buffer<uint8_t> body {};
+  http_response response {status_codes::OK};
+  response.set_body(body.create_istream(), "application/json");
+  message.reply(response);
+
+  write_string(body, "[")
+    .then([table, query, body] ()
+          {
+            return write_segments(table, query, continuation_token {}, body, true);
+          })
+    .then([body] (pplx::task<void> written)
+          {
+            bool complete {false};
+            try {
+              written.get();
+              complete = true;
+            }
+            catch (const storage_exception& e) {
+              cout << "Azure Table Storage error: " << e.what() << endl;
+              cout << e.result().extended_error().message() << endl;
+            }
+            catch (const std::exception& e) {
+              cout << e.what() << endl;
+            }
+            return write_string(body, complete ? "]" : "")
+              .then([body] () mutable
+                    {
+                      return body.close(std::ios_base::out);
+                    });
+          });
+}
+
+/*
+  This local function replies to message with status OK and a JSON array
+  of at most page.size entities from query, in the same form as
+  reply_with_entities(), starting where page.token left off.
+
+  Only a single Azure segment is read. If more entities remain, the
+  reply carries a Continuation-Token header to pass as the continuation
+  parameter of the next request.
+
+  A continuation token is only checked for form by parse_page_request(),
+  so one that Azure rejects gets BadRequest. Any other error gets
+  InternalError.
+ */
+void reply_with_page(http_request message, cloud_table table,
+                     table_query query, const page_request_t& page) {
+  query.set_take_count(page.size);
+  table.execute_query_segmented_async(query, page.token)
+    .then([message] (pplx::task<table_query_segment> result)
+          {
+            try {
+              table_query_segment segment {result.get()};
+
+              string entities {"["};
+              for (const auto& e : segment.results()) {
+                cout << "Key: " << e.partition_key() << " / " << e.row_key() << endl;
+
+                if (entities.size() > 1)
+                  entities += ',';
+                append_entity_json(entities, e);
+              }
+              entities += ']';
+
+              http_response response {status_codes::OK};
+              if (!segment.continuation_token().empty()) {
+                response.headers().add(continuation_header,
+                                       encode_continuation(segment.continuation_token()));
+              }
+              response.set_body(entities, "application/json");
+              message.reply(response);
+            }
+            catch (const storage_exception& e) {
+              cout << "Azure Table Storage error: " << e.what() << endl;
+              cout << e.result().extended_error().message() << endl;
+              // A continuation token that parsed but names no real
+              // position is rejected by Azure with BadRequest
+              if (e.result().http_status_code() == status_codes::BadRequest)
+                message.reply(status_codes::BadRequest);
+              else
+                message.reply(status_codes::InternalError);
+            }
+            catch (const std::exception& e) {
+              cout << e.what() << endl;
+              message.reply(status_codes::InternalError);
+            }
+          });
+}
+
+/*
+  This local function returns the result of get_specific() for an
+  entity read with the given status code: the code, and the entity's
+  properties as JSON text, empty if the read failed or the entity has
+  no properties.
+ */
+pair<status_code, string> specific_result(status_code code,
+                                          const table_entity& entity) {
+  cout << "HTTP code: " << code << endl;
+  string body {};
+  if (code != status_codes::OK) {
+    return make_pair(code, body);
   }
 
-  return entity_vec;
+  // If the entity has any properties, return them as JSON
+  if ( ! entity.properties().empty()) {
+    append_properties_json(body, entity.properties());
+  }
+  return make_pair(code, body);
 }
 
 /*
-  This local function returns all properties of a requested entity.
+  This local function returns a task for all properties of a
+  requested entity, as JSON text written by append_properties_json().
+  The task completes when Azure responds (at once if the entity is in
+  the entity cache); no thread is blocked meanwhile.
   Any error when authenticating with the token will return a status code
   other than status_codes::OK.
 
+  The caller must already have checked that the table exists.
+
   An exception is thrown if:
     The operation is incorrect or nonexistent (invalid_argument)
-    The table name is incorrect or nonexistent (invalid_argument)
     The partition name is nonexistent (invalid_argument)
     The row name is nonexistent (invalid_argument)
     The row name is "*" (logic_error)
     The operation is ReadEntityAuth but the token is nonexistent (logic_error)
+  An Azure error is reported as an exception from the task.
  */
-pair<status_code, prop_vals_t> get_specific(http_request message,
-                                            get_request_t request) {
+pplx::task<pair<status_code, string>> get_specific(http_request message,
+                                                   get_request_t request) {
   if (request.operation != read_entity_admin &&
       request.operation != read_entity_auth) {
     throw std::invalid_argument ("Error: get_specific() was given an "\
       "invalid operation.\n");
   }
 
-  // Check for specified table
   cloud_table table {table_cache.lookup_table(request.table)};
-  if ( !table.exists() ) {
-    throw std::invalid_argument ("Error: get_specific() was given an "\
-      "invalid table name.\n");
-  }
 
   if (request.partition == "") {
     throw std::invalid_argument ("Error: get_specific was not given a "\
@@ -392,144 +800,391 @@ pair<status_code, prop_vals_t> get_specific(http_request message,
       "operation ReadEntityAuth, but was not given a token.\n");
   }
 
+  if (request.operation == read_entity_auth)
+  {
+    // Retrieve entity using token method
+    return read_with_token_async(message, tables_endpoint)
+      .then([] (pair<status_code, table_entity> result_pair)
+            {
+              return specific_result(result_pair.first, result_pair.second);
+            });
+  }
+
+  // Entities read with a token are never cached, as the token must
+  // be checked by Azure on every read
+  const string table_name {request.table};
+  const string partition {request.partition};
+  const string row {request.row};
+  table_entity cached;
+  EntityCache::ticket_t ticket;
+  if (entity_cache.lookup(table_name, partition, row, cached, ticket)) {
+    return pplx::task_from_result(specific_result(status_codes::OK, cached));
+  }
+
   table_operation retrieve_operation {
     table_operation::retrieve_entity(
       request.partition,
       request.row
     )
   };
+  return table.execute_async(retrieve_operation)
+    .then([table_name, partition, row, ticket] (table_result retrieve_result)
+          {
+            const status_code code {static_cast<status_code>(retrieve_result.http_status_code())};
+            if (code == status_codes::OK) {
+              entity_cache.insert(table_name, partition, row, retrieve_result.entity(), ticket);
+            }
+            return specific_result(code, retrieve_result.entity());
+          });
+}
 
-  table_result retrieve_result;
-  if (request.operation == read_entity_auth)
-  {
-  	// Retrieve entity using token method
-  	pair<web::http::status_code, table_entity> result_pair =
-      read_with_token(message, tables_endpoint);
-  	// Convert into results type
-  	retrieve_result.set_http_status_code(result_pair.first);
-  	retrieve_result.set_entity(result_pair.second);
-  }
-  else if(request.operation == read_entity_admin)
-  {
-  	retrieve_result = table.execute(retrieve_operation);
-  }
+/*
+  This local function calls found if the named table exists. Otherwise
+  it replies NotFound to message, or InternalError if the check fails.
 
-  //Check status codes
-  cout << "HTTP code: " << retrieve_result.http_status_code() << endl;
-  if (retrieve_result.http_status_code() == status_codes::NotFound) {
-    prop_vals_t empty_prop;
-    return make_pair(status_codes::NotFound, empty_prop);
-  }
-  //Place entity and parse properties
-  table_entity entity {retrieve_result.entity()};
-  table_entity::properties_type properties {entity.properties()};
+  A table already known to exist is found at once; otherwise found is
+  called from a continuation once Azure has answered, and no thread
+  waits meanwhile.
+ */
+void if_table_exists(http_request message, const string& table_name,
+                     std::function<void ()> found) {
+  table_cache.table_exists_async(table_name)
+    .then([message, found] (pplx::task<bool> exists)
+          {
+            try {
+              if ( ! exists.get()) {
+                message.reply(status_codes::NotFound);
+                return;
+              }
+            }
+            catch (const std::exception& e) {
+              cout << e.what() << endl;
+              message.reply(status_codes::InternalError);
+              return;
+            }
+            found();
+          });
+}
 
-  // If the entity has any properties, return them as JSON
-  prop_vals_t values (get_properties(properties));
-  return make_pair(status_codes::OK, values);
+/*
+  This local function returns a task for the JSON body of message,
+  which completes once the body has arrived. The value is null if
+  message has no JSON body or the body is not valid JSON.
+ */
+pplx::task<value> json_body_async(http_request message) {
+  if ( ! has_json_body(message))
+    return pplx::task_from_result(value {});
+  return message.extract_json(true)
+    .then([] (pplx::task<value> body) -> value
+          {
+            try {
+              return body.get();
+            }
+            catch (const std::exception& e) {
+              cout << e.what() << endl;
+              return value {};
+            }
+          });
 }
 
-}  // Unnamed namespace for local functions and structures
+// Indices into the request's entities of the elements naming one entity, in order
+using occurrences_t = vector<std::size_t>;
 
 /*
-  Convert properties represented in Azure Storage type
-  to prop_vals_t type.
+  State of an UpdateEntitiesAdmin request, shared by its continuations
  */
-prop_vals_t get_properties (const table_entity::properties_type& properties, prop_vals_t values) {
-  for (const auto v : properties) {
-    if (v.second.property_type() == edm_type::string) {
-      values.push_back(make_pair(v.first, value::string(v.second.string_value())));
-    }
-    else if (v.second.property_type() == edm_type::datetime) {
-      values.push_back(make_pair(v.first, value::string(v.second.str())));
-    }
-    else if(v.second.property_type() == edm_type::int32) {
-      values.push_back(make_pair(v.first, value::number(v.second.int32_value())));
-    }
-    else if(v.second.property_type() == edm_type::int64) {
-      values.push_back(make_pair(v.first, value::number(v.second.int64_value())));
-    }
-    else if(v.second.property_type() == edm_type::double_floating_point) {
-      values.push_back(make_pair(v.first, value::number(v.second.double_value())));
-    }
-    else if(v.second.property_type() == edm_type::boolean) {
-      values.push_back(make_pair(v.first, value::boolean(v.second.boolean_value())));
+struct batch_update_t {
+  cloud_table table {};
+  string table_name {};
+  value entities {};
+  vector<status_code> statuses {};
+  // The entities in each transaction
+  vector<vector<occurrences_t>> batches {};
+};
+
+/*
+  This local function merges each entity of a JSON array into a table,
+  inserting entities which do not exist yet.
+
+  Each element of the array is a JSON object with the properties
+  "Partition" and "Row", naming the entity, and any other properties
+  to merge into it. Non-string property values are stored as their
+  JSON serialization, as for UpdateEntityAdmin.
+
+  Entities are grouped by partition and each group is split into
+  entity group transactions of at most max_batch_size entities. Up to
+  max_concurrent_batches transactions run at once. A transaction
+  succeeds or fails as a whole, so every entity in a failed transaction
+  gets the status of that failure.
+
+  Azure rejects a transaction that names the same entity twice, so the
+  elements naming one entity are merged into a single operation, later
+  properties replacing earlier ones, as if each were merged in turn.
+  Every such element gets the status of that operation.
+
+  Returns a task for a JSON array with one object per element of
+  entities, in the same order, holding its "Partition", "Row" and
+  "Status" (the HTTP status code for that entity). An element which
+  is not an object with string "Partition" and "Row" properties gets
+  the status BadRequest. No thread is blocked while Azure runs the
+  transactions.
+ */
+pplx::task<vector<value>> update_entities(const cloud_table& table, const string& table_name,
+                                          const value& entities) {
+  auto state = std::make_shared<batch_update_t>();
+  state->table = table;
+  state->table_name = table_name;
+  state->entities = entities;
+  const web::json::array& all (state->entities.as_array());
+  state->statuses.assign(all.size(), status_codes::BadRequest);
+
+  // Indices of the valid elements naming each entity, by partition and row
+  std::map<string,std::map<string,occurrences_t>> partitions {};
+  for (std::size_t i {0}; i < all.size(); ++i) {
+    const value& e (all.at(i));
+    if (e.is_object() && e.has_field("Partition") && e.at("Partition").is_string() &&
+        e.has_field("Row") && e.at("Row").is_string()) {
+      partitions[e.at("Partition").as_string()][e.at("Row").as_string()].push_back(i);
     }
-    else {
-      values.push_back(make_pair(v.first, value::string(v.second.str())));
+  }
+
+  // Split each partition into transactions
+  for (const auto& p : partitions) {
+    vector<occurrences_t> batch {};
+    for (const auto& r : p.second) {
+      batch.push_back(r.second);
+      if (batch.size() == max_batch_size) {
+        state->batches.push_back(batch);
+        batch.clear();
+      }
     }
+    if ( ! batch.empty())
+      state->batches.push_back(batch);
   }
-  return values;
-}
 
-/*
-  Return true if an HTTP request has a JSON body
+  // Run the transactions in waves of max_concurrent_batches
+  pplx::task<void> waves {pplx::task_from_result()};
+  for (std::size_t wave {0}; wave < state->batches.size(); wave += max_concurrent_batches) {
+    waves = waves.then([state, wave] ()
+      {
+        const web::json::array& all (state->entities.as_array());
+        vector<pplx::task<void>> tasks {};
+        for (std::size_t b {wave}; b < state->batches.size() && b < wave + max_concurrent_batches; ++b) {
+          const vector<occurrences_t>& entities (state->batches[b]);
+          table_batch_operation batch {};
+          for (const occurrences_t& occurrences : entities) {
+            const value& first (all.at(occurrences.front()));
+            table_entity entity {first.at("Partition").as_string(), first.at("Row").as_string()};
+            table_entity::properties_type& properties = entity.properties();
+            for (const std::size_t i : occurrences) {
+              for (const auto& v : all.at(i).as_object()) {
+                if (v.first == "Partition" || v.first == "Row")
+                  continue;
+                properties[v.first] = entity_property {
+                  v.second.is_string() ? v.second.as_string() : v.second.serialize()
+                };
+              }
+            }
+            batch.insert_or_merge_entity(entity);
+          }
+          cout << "Batch update " << all.at(entities.front().front()).at("Partition").as_string()
+               << " (" << entities.size() << " entities)" << endl;
+
+          tasks.push_back(state->table.execute_batch_async(batch)
+            .then([state, b] (pplx::task<vector<table_result>> result)
+                  {
+                    status_code code {status_codes::OK};
+                    try {
+                      result.get();
+                    }
+                    catch (const storage_exception& e) {
+                      cout << "Azure Table Storage error: " << e.what() << endl;
+                      code = e.result().http_status_code() != 0 ?
+                        static_cast<status_code>(e.result().http_status_code()) :
+                        status_codes::InternalError;
+                    }
+                    for (const occurrences_t& occurrences : state->batches[b]) {
+                      for (const std::size_t i : occurrences)
+                        state->statuses[i] = code;
+                    }
+                  }));
+        }
+        return pplx::when_all(tasks.begin(), tasks.end());
+      });
+  }
 
-  This routine can be called multiple times on the same message.
- */
-bool has_json_body (http_request message) {
-  return message.headers()["Content-type"] == "application/json";
+  return waves.then([state] ()
+    {
+      const web::json::array& all (state->entities.as_array());
+      vector<value> results {};
+      for (std::size_t i {0}; i < all.size(); ++i) {
+        const value& e (all.at(i));
+        vector<pair<string,value>> result {};
+        if (e.is_object() && e.has_field("Partition") && e.has_field("Row")) {
+          result.push_back(make_pair("Partition", e.at("Partition")));
+          result.push_back(make_pair("Row", e.at("Row")));
+          if (state->statuses[i] != status_codes::BadRequest &&
+              e.at("Partition").is_string() && e.at("Row").is_string()) {
+            entity_cache.invalidate(state->table_name,
+                                    e.at("Partition").as_string(),
+                                    e.at("Row").as_string());
+          }
+        }
+        result.push_back(make_pair("Status", value::number(static_cast<int>(state->statuses[i]))));
+        results.push_back(value::object(result));
+      }
+      return results;
+    });
 }
 
 /*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-  get_json_body and get_json_bourne are valid and identical function calls.
-
-  If the message has no JSON body, return an empty map.
-
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
-
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
+  State of a ReadEntitiesAdmin request, shared by its continuations
  */
+struct multi_read_t {
+  cloud_table table {};
+  string table_name {};
+  value keys {};
+  vector<status_code> statuses {};
+  vector<table_entity> found {};
+  vector<EntityCache::ticket_t> tickets {};
+  // Indices into keys of the valid keys which are not in the cache
+  vector<std::size_t> misses {};
+};
 
-unordered_map<string,string> get_json_body(http_request message) {
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
+/*
+  This local function reads many entities of a table by their keys.
+
+  Each element of keys is a JSON object with the string properties
+  "Partition" and "Row". Entities in the entity cache are taken from
+  it, and the rest are read from Azure, up to max_concurrent_reads
+  point reads at a time.
+
+  Returns a task for the text of a JSON array with one object per
+  element of keys, in the same order, holding its "Partition", "Row"
+  and "Status":
+    OK: the entity was found, and its properties are in "Entity"
+    NotFound: the entity does not exist
+    BadRequest: the element is not an object with string "Partition"
+      and "Row" properties
+    Any other status: the read from Azure failed
+  No thread is blocked while Azure runs the reads.
+ */
+pplx::task<string> read_entities(const cloud_table& table, const string& table_name,
+                                 const value& keys) {
+  auto state = std::make_shared<multi_read_t>();
+  state->table = table;
+  state->table_name = table_name;
+  state->keys = keys;
+  const web::json::array& all (state->keys.as_array());
+  state->statuses.assign(all.size(), status_codes::BadRequest);
+  state->found.resize(all.size());
+  state->tickets.resize(all.size());
+
+  for (std::size_t i {0}; i < all.size(); ++i) {
+    const value& k (all.at(i));
+    if ( ! (k.is_object() && k.has_field("Partition") && k.at("Partition").is_string() &&
+            k.has_field("Row") && k.at("Row").is_string()))
+      continue;
+    if (entity_cache.lookup(table_name, k.at("Partition").as_string(), k.at("Row").as_string(),
+                            state->found[i], state->tickets[i]))
+      state->statuses[i] = status_codes::OK;
+    else
+      state->misses.push_back(i);
+  }
 
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-	  {
-            json = v;
-	    return true;
-	  })
-    .wait();
+  // Run the reads in waves of max_concurrent_reads
+  pplx::task<void> waves {pplx::task_from_result()};
+  for (std::size_t wave {0}; wave < state->misses.size(); wave += max_concurrent_reads) {
+    waves = waves.then([state, wave] ()
+      {
+        const web::json::array& all (state->keys.as_array());
+        vector<pplx::task<void>> tasks {};
+        for (std::size_t m {wave}; m < state->misses.size() && m < wave + max_concurrent_reads; ++m) {
+          const std::size_t i {state->misses[m]};
+          const string partition {all.at(i).at("Partition").as_string()};
+          const string row {all.at(i).at("Row").as_string()};
+          tasks.push_back(state->table.execute_async(table_operation::retrieve_entity(partition, row))
+            .then([state, i, partition, row] (pplx::task<table_result> result)
+                  {
+                    try {
+                      table_result retrieve_result {result.get()};
+                      state->statuses[i] = static_cast<status_code>(retrieve_result.http_status_code());
+                      if (state->statuses[i] == status_codes::OK) {
+                        state->found[i] = retrieve_result.entity();
+                        entity_cache.insert(state->table_name, partition, row,
+                                            state->found[i], state->tickets[i]);
+                      }
+                    }
+                    catch (const storage_exception& e) {
+                      cout << "Azure Table Storage error: " << e.what() << endl;
+                      state->statuses[i] = e.result().http_status_code() != 0 ?
+                        static_cast<status_code>(e.result().http_status_code()) :
+                        status_codes::InternalError;
+                    }
+                  }));
+        }
+        return pplx::when_all(tasks.begin(), tasks.end());
+      });
+  }
 
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-	results[v.first] = v.second.as_string();
-      }
-      else {
-	results[v.first] = v.second.serialize();
+  return waves.then([state] ()
+    {
+      const web::json::array& all (state->keys.as_array());
+      string results {"["};
+      for (std::size_t i {0}; i < all.size(); ++i) {
+        if (i > 0)
+          results += ',';
+        const value& k (all.at(i));
+        const int status {static_cast<int>(state->statuses[i])};
+        if (state->statuses[i] == status_codes::OK) {
+          // Found entities are written as text, like streamed reads
+          results += "{\"Partition\":";
+          append_json_string(results, k.at("Partition").as_string());
+          results += ",\"Row\":";
+          append_json_string(results, k.at("Row").as_string());
+          results += ",\"Status\":" + std::to_string(status) + ",\"Entity\":";
+          append_properties_json(results, state->found[i].properties());
+          results += '}';
+          continue;
+        }
+        vector<pair<string,value>> result {};
+        if (k.is_object() && k.has_field("Partition") && k.has_field("Row")) {
+          result.push_back(make_pair("Partition", k.at("Partition")));
+          result.push_back(make_pair("Row", k.at("Row")));
+        }
+        result.push_back(make_pair("Status", value::number(status)));
+        results += value::object(result).serialize();
       }
-    }
-  }
-  return results;
+      results += ']';
+      return results;
+    });
 }
 
-unordered_map<string,string> get_json_bourne(http_request message) {
- return get_json_body(message);
-}
+}  // Unnamed namespace for local functions and structures
 
 /*
-  Top-level routine for processing all HTTP GET requests.
+  Top-level routines for processing HTTP GET requests, dispatched
+  by operation name through the GET router set up in main().
 
   HTTP URL for this server is defined in this file as http://localhost:34568.
 
-  Operation names: ReadEntityAdmin, ReadEntityAuth
+  Operation names: ReadEntityAdmin, ReadEntityAuth, ReadEntitiesAdmin
 
   Possible operations:
 
+    Operation:
+      Returns a JSON array with one object per requested entity, in the
+      order requested. Each object holds the "Partition" and "Row" of the
+      entity and its "Status": 200 if it was found, in which case its
+      properties are in the JSON object "Entity", or 404 if it was not.
+    Body:
+      JSON array of objects, each with the properties "Partition" and "Row".
+      E.g. [{"Partition":"USA", "Row":"Franklin,Aretha"}]
+    Administrative URI:
+      http://localhost:34568/ReadEntitiesAdmin/TABLE_NAME
+    cURL command:
+      curl -iX get -H 'Content-Type: application/json' -d '[{"Partition" : "PARTITION_NAME", "Row" : "ROW_NAME"}]' URI
+
     Operation:
       Returns a JSON object with all properties of a requested entity.
     Body:
@@ -547,7 +1202,8 @@ unordered_map<string,string> get_json_bourne(http_request message) {
     Operation:
       Returns a JSON array of objects containing all entities in the requested
       table which have all of the requested properties (regardless of value).
-      Each element in the JSON array is a single entity.
+      Each element in the JSON array is a single entity, holding only the
+      requested properties along with "Partition" and "Row".
     Body:
       JSON object representing an array where each element is a property
       represented by a string / JSON value pair. The first value of each element
@@ -595,49 +1251,57 @@ unordered_map<string,string> get_json_bourne(http_request message) {
     cURL command:
       curl -iX get URI
     // TODO: This does not safely handle a property named "Partition" or "Row".
- */
-void handle_get(http_request message) {
-  // string path {uri::decode(message.relative_uri().path())};
-  string path = message.relative_uri().path();
-  cout << endl << "**** GET " << path << endl;
-  auto paths = uri::split_path(path);
-  // Need at least an operation name and table name
-  if (paths.size() < 2)
-  {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-
-  // Checking for well-formed request before passing to
-  // parse_get_request_paths()
-  // [0] refers to the operation name
-  // Evaluated after size() to ensure legitimate access
-  if (paths[0] == read_entity_admin) {
-
-    if(paths.size() != 2 &&
-       paths.size() != 4) {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-  }
 
-  else if (paths[0] == read_entity_auth) {
+    Paging (administrative table and partition reads only):
+      Adding ?pagesize=N (1 to 1000) to the URI returns at most N entities.
+      If more entities remain, the response has a Continuation-Token header;
+      pass its value back as ?pagesize=N&continuation=TOKEN to read the
+      next page. The last page has no Continuation-Token header.
+    cURL command:
+      curl -iX get 'http://localhost:34568/ReadEntityAdmin/TABLE_NAME?pagesize=100'
+ */
+void handle_read_entities(http_request message, const vector<string>& paths) {
+  // Get many entities by their keys
+  const string table_name {paths[1]};
+  if_table_exists(message, table_name, [message, table_name] ()
+    {
+      json_body_async(message)
+        .then([message, table_name] (value json_body)
+              {
+                if ( ! json_body.is_array()) {
+                  message.reply(status_codes::BadRequest);
+                  return;
+                }
+                cloud_table table {table_cache.lookup_table(table_name)};
+                read_entities(table, table_name, json_body)
+                  .then([message] (pplx::task<string> result)
+                        {
+                          try {
+                            message.reply(status_codes::OK, result.get(), "application/json");
+                          }
+                          catch (const std::exception& e) {
+                            cout << e.what() << endl;
+                            message.reply(status_codes::InternalError);
+                          }
+                        });
+              });
+    });
+}
 
-    if(paths.size() != 5) {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-  }
+void read_from_table(http_request message, const get_request_t& request,
+                     const page_request_t& page);
 
-  // Incorrect operation name
-  else {
+void handle_read_entity(http_request message, const vector<string>& paths) {
+  // The router accepts 2 to 4 paths for ReadEntityAdmin,
+  // of which only 3 is malformed
+  if (paths.size() == 3) {
     message.reply(status_codes::BadRequest);
     return;
   }
 
   get_request_t request;
   try {
-    request = parse_get_request_paths(message);
+    request = parse_get_request_paths(paths);
   }
   catch( const std::exception& e ) {
     cout << e.what();
@@ -645,50 +1309,75 @@ void handle_get(http_request message) {
     return;
   }
 
-  // Check for specified table
-  cloud_table table {table_cache.lookup_table(request.table)};
-  if ( ! table.exists()) {
-    message.reply(status_codes::NotFound);
+  page_request_t page;
+  try {
+    page = parse_page_request(message);
+  }
+  catch( const std::exception& e ) {
+    cout << e.what();
+    message.reply(status_codes::BadRequest);
     return;
   }
 
+  // Check for specified table
+  if_table_exists(message, request.table, [message, request, page] ()
+    {
+      read_from_table(message, request, page);
+    });
+}
+
+/*
+  Reply to a ReadEntityAdmin or ReadEntityAuth request, once its table
+  is known to exist.
+ */
+void read_from_table(http_request message, const get_request_t& request,
+                     const page_request_t& page) {
+  cloud_table table {table_cache.lookup_table(request.table)};
+
   // Get all entities in the table, or
   // Get all entities in the table with specific properties
   if (request.paths_count == 2) {
-    unordered_map<string,string> json_body = get_json_body (message);
-    for(const auto v : json_body){
-      if(v.second != "*"){
-        message.reply(status_codes::BadRequest);
-        return;
-      }
-    }
-    vector<value> v;
-    try {
-      v = get_table_or_properties(request, json_body);
-    }
-    catch(const std::exception& e) {
-      cout << e.what();
-      message.reply(status_codes::InternalError);
-      return;
-    }
-    message.reply(status_codes::OK, value::array(v));
+    with_json_body(message, [message, request, page, table] (const unordered_map<string,string>& json_body)
+            {
+              for(const auto v : json_body){
+                if(v.second != "*"){
+                  message.reply(status_codes::BadRequest);
+                  return;
+                }
+              }
+              table_query query;
+              try {
+                query = get_table_or_properties(request, json_body);
+              }
+              catch(const std::exception& e) {
+                cout << e.what();
+                message.reply(status_codes::InternalError);
+                return;
+              }
+              if (page.size == 0)
+                reply_with_entities(message, table, query);
+              else
+                reply_with_page(message, table, query, page);
+            });
     return;
   }
 
   // Get all entities in the partition
   else if (request.paths_count == 4 && request.row == "*")
   {
-    vector<value> entities;
+    table_query query;
     try {
-      entities = get_partition(request);
+      query = get_partition(request);
     }
     catch (const std::exception& e) {
       cout << e.what();
       message.reply(status_codes::InternalError);
       return;
     }
-
-    message.reply(status_codes::OK, value::array(entities));
+    if (page.size == 0)
+      reply_with_entities(message, table, query);
+    else
+      reply_with_page(message, table, query, page);
     return;
   }
 
@@ -698,9 +1387,9 @@ void handle_get(http_request message) {
            (request.paths_count == 5 &&
             request.operation == read_entity_auth) ) {
 
-    pair<status_code, prop_vals_t> result;
+    pplx::task<pair<status_code, string>> specific;
     try {
-      result = get_specific(message, request);
+      specific = get_specific(message, request);
     }
     catch(const std::exception& e) {
       cout << e.what();
@@ -708,18 +1397,29 @@ void handle_get(http_request message) {
       return;
     }
 
-    if(result.first != status_codes::OK) {
-      message.reply(result.first);
-      return;
-    }
-    else if (result.second.size() > 0) {
-      message.reply(status_codes::OK, value::object(result.second));
-      return;
-    }
-    else {
-      message.reply(status_codes::OK);
-      return;
-    }
+    specific.then([message] (pplx::task<pair<status_code, string>> task)
+      {
+        pair<status_code, string> result;
+        try {
+          result = task.get();
+        }
+        catch(const std::exception& e) {
+          cout << e.what();
+          message.reply(status_codes::InternalError);
+          return;
+        }
+
+        if(result.first != status_codes::OK) {
+          message.reply(result.first);
+        }
+        else if ( ! result.second.empty()) {
+          message.reply(status_codes::OK, std::move(result.second), "application/json");
+        }
+        else {
+          message.reply(status_codes::OK);
+        }
+      });
+    return;
   }
 
   // Invalid/badly-formed request was not caught earlier
@@ -730,7 +1430,8 @@ void handle_get(http_request message) {
 }
 
 /*
-  Top-level routine for processing all HTTP POST requests.
+  Top-level routine for processing HTTP POST requests, dispatched
+  by operation name through the POST router set up in main().
 
   HTTP URL for this server is defined in this file as http://localhost:34568.
 
@@ -745,43 +1446,42 @@ void handle_get(http_request message) {
   cURL command:
     curl -iX post URI
 */
-void handle_post(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
-
-  auto paths = uri::split_path(path);
-  // Need at least an operation and a table name
-  if (paths.size() < 2) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  // [0] refers to the operation name
-  // Evaluated after size() to ensure legitimate access
-  else if (paths[0] != create_table_op) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-
+void handle_create_table(http_request message, const vector<string>& paths) {
   string table_name {paths[1]};
   cloud_table table {table_cache.lookup_table(table_name)};
 
   // Create table (idempotent if table exists)
   cout << "Create " << table_name << endl;
-  bool created {table.create_if_not_exists()};
-  cout << "Administrative table URI " << table.uri().primary_uri().to_string() << endl;
-  if (created)
-    message.reply(status_codes::Created);
-  else
-    message.reply(status_codes::Accepted);
+  table_cache.create_table_async(table_name)
+    .then([message, table] (pplx::task<bool> result)
+          {
+            bool created {};
+            try {
+              created = result.get();
+            }
+            catch (const storage_exception& e) {
+              cout << "Azure Table Storage error: " << e.what() << endl;
+              message.reply(status_codes::InternalError);
+              return;
+            }
+            cout << "Administrative table URI " << table.uri().primary_uri().to_string() << endl;
+            if (created)
+              message.reply(status_codes::Created);
+            else
+              message.reply(status_codes::Accepted);
+          });
 }
 
 /*
-  Top-level routine for processing all HTTP PUT requests.
+  Top-level routines for processing HTTP PUT requests, dispatched
+  by operation name through the PUT router set up in main().
 
   HTTP URL for this server is defined in this file as http://localhost:34568.
 
   Operation names:
     UpdateEntityAdmin, UpdateEntityAuth
+    UpdateEntitiesAdmin
+    AppendListItemAuth, RemoveListItemAuth
     AddPropertyAdmin
     UpdatePropertyAdmin
 
@@ -807,6 +1507,41 @@ void handle_post(http_request message) {
     cURL command:
       curl -iX put -H 'Content-Type: application/json' -d '{"PROPERTY_NAME" : "PROPERTY_VALUE", "PROPERTY_NAME" : "PROPERTY_VALUE"}' URI
 
+    Operation:
+      Updates many entities in a single request. Each entity is updated as
+      for UpdateEntityAdmin, and entities in the same partition are written
+      together in entity group transactions.
+    Body:
+      JSON array of objects, one per entity. Each object has the properties
+      "Partition" and "Row", naming the entity, and the properties to set.
+      E.g. [{"Partition":"USA", "Row":"Franklin,Aretha", "born":"1942"}]
+    Response:
+      JSON array with one object per entity, in the order of the body,
+      holding its "Partition", "Row" and "Status" (the HTTP status code of
+      the update of that entity).
+    URI:
+      http://localhost:34568/UpdateEntitiesAdmin/TABLE_NAME
+    cURL command:
+      curl -iX put -H 'Content-Type: application/json' -d '[{"Partition" : "PARTITION_NAME", "Row" : "ROW_NAME", "PROPERTY_NAME" : "PROPERTY_VALUE"}]' URI
+
+    Operation:
+      Appends an item to, or removes every copy of an item from, a list
+      held in a property of an entity, such as a friends list. An item
+      already in the list is not appended again. Elements
+      of the list are separated by '|'. The edit is made in a single
+      request, safely against concurrent edits; Conflict (409) means
+      other writers kept winning and the edit was not made.
+    Body:
+      JSON object with a single property, the name of the list property,
+      whose value is the item, which must not be empty or contain '|'.
+      E.g. {"Friends":"USA;Franklin,Aretha"}
+    URI:
+      http://localhost:34568/AppendListItemAuth/TABLE_NAME/AUTHENTICATION_TOKEN/PARTITION_NAME/ROW_NAME
+      http://localhost:34568/RemoveListItemAuth/TABLE_NAME/AUTHENTICATION_TOKEN/PARTITION_NAME/ROW_NAME
+      (AUTHENTICATION_TOKEN is obtained from AuthServer, with update permission)
+    cURL command:
+      curl -iX put -H 'Content-Type: application/json' -d '{"PROPERTY_NAME" : "ITEM"}' URI
+
     // TODO: AddPropertyAdmin has not been implemented yet.
     Operation:
       Updates all entities in the given table with the given property,
@@ -840,54 +1575,119 @@ void handle_post(http_request message) {
     cURL command:
       curl -iX put -H 'Content-Type: application/json' -d '{"PROPERTY_NAME" : "PROPERTY_VALUE", "PROPERTY_NAME" : "PROPERTY_VALUE"}' URI
  */
-void handle_put(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** PUT " << path << endl;
+void handle_update_entities(http_request message, const vector<string>& paths) {
+  const string table_name {paths[1]};
+  if_table_exists(message, table_name, [message, table_name] ()
+    {
+      json_body_async(message)
+        .then([message, table_name] (value json_body)
+              {
+                if ( ! json_body.is_array()) {
+                  message.reply(status_codes::BadRequest);
+                  return;
+                }
+                cloud_table table {table_cache.lookup_table(table_name)};
+                update_entities(table, table_name, json_body)
+                  .then([message] (pplx::task<vector<value>> result)
+                        {
+                          try {
+                            message.reply(status_codes::OK, value::array(result.get()));
+                          }
+                          catch (const std::exception& e) {
+                            cout << e.what() << endl;
+                            message.reply(status_codes::InternalError);
+                          }
+                        });
+              });
+    });
+}
 
-  auto paths = uri::split_path(path);
-  // Need at least an operation, table name, partition, and row
-  if (paths.size() < 4) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  // [0] refers to the operation name
-  // Evaluated after size() to ensure legitimate access
-  else if(paths[0] == add_property_admin || paths[0] == update_property_admin){
-    message.reply(status_codes::NotImplemented);
-    return;
-  }
+void handle_update_property(http_request message, const vector<string>& paths) {
+  message.reply(status_codes::NotImplemented);
+}
+
+void handle_edit_list(http_request message, const vector<string>& paths) {
+  const string table_name {paths[1]};
+  const string partition {paths[3]};
+  const string row {paths[4]};
+  const list_edit edit {paths[0] == append_list_item_auth ? list_edit::append : list_edit::remove};
+  if_table_exists(message, table_name, [message, table_name, partition, row, edit] ()
+    {
+      with_json_body(message, [message, table_name, partition, row, edit] (const unordered_map<string,string>& json_body)
+        {
+          if (json_body.size() != 1 ||
+              json_body.begin()->second.empty() ||
+              json_body.begin()->second.find(list_separator) != string::npos) {
+            message.reply(status_codes::BadRequest);
+            return;
+          }
+
+          edit_list_with_token_async (message, tables_endpoint,
+                                      json_body.begin()->first, json_body.begin()->second, edit)
+            .then([message, table_name, partition, row] (pplx::task<status_code> result)
+                  {
+                    status_code edit_status;
+                    try {
+                      edit_status = result.get();
+                    }
+                    catch (const std::exception& e) {
+                      cout << e.what() << endl;
+                      message.reply(status_codes::InternalError);
+                      return;
+                    }
+                    entity_cache.invalidate(table_name, partition, row);
+                    message.reply(edit_status);
+                  });
+        });
+    });
+}
+
+void update_from_body(http_request message, const vector<string>& paths,
+                      const unordered_map<string,string>& json_body);
+
+void handle_update_entity(http_request message, const vector<string>& paths) {
   // Checking to ensure the table exists
   // Should be done before anything else
+  if_table_exists(message, paths[1], [message, paths] ()
+    {
+      with_json_body(message, [message, paths] (const unordered_map<string,string>& json_body)
+        {
+          update_from_body(message, paths, json_body);
+        });
+    });
+}
+
+/*
+  Carry out an UpdateEntityAdmin or UpdateEntityAuth request, once its
+  table is known to exist and its body has arrived.
+ */
+void update_from_body(http_request message, const vector<string>& paths,
+                      const unordered_map<string,string>& json_body) {
   cloud_table table {table_cache.lookup_table(paths[1])};
-  if ( ! table.exists()) {
-    message.reply(status_codes::NotFound);
-    return;
-  }
 
-  else if(paths[0] == update_entity_auth){
-    unordered_map<string,string> json_body {get_json_bourne (message)};
-    auto update_with_token_response = update_with_token (message, tables_endpoint, json_body);
-    if (update_with_token_response == status_codes::Forbidden)
-    {
-      if (paths[2].find("&sp=ru", 0) == string::npos)
-      {
-        message.reply(status_codes::Forbidden);
-        return;
-      }
-      else{
-        message.reply(status_codes::NotFound);
-        return;
-      }
-    }
-    message.reply(update_with_token_response);
+  if(paths[0] == update_entity_auth){
+    const string table_name {paths[1]};
+    const string partition {paths[3]};
+    const string row {paths[4]};
+    update_with_token_async (message, tables_endpoint, json_body)
+      .then([message, table_name, partition, row] (pplx::task<status_code> result)
+            {
+              status_code update_with_token_response;
+              try {
+                update_with_token_response = result.get();
+              }
+              catch (const std::exception& e) {
+                cout << e.what() << endl;
+                message.reply(status_codes::InternalError);
+                return;
+              }
+              // A token without update permission is Forbidden, and one
+              // for another entity NotFound (see update_with_token_async)
+              entity_cache.invalidate(table_name, partition, row);
+              message.reply(update_with_token_response);
+            });
     return;
   }
-  else if (paths[0] != update_entity_admin) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-
-  unordered_map<string,string> json_body {get_json_bourne (message)};
 
   table_entity entity {paths[2], paths[3]}; // partition and row
 
@@ -899,14 +1699,27 @@ void handle_put(http_request message) {
   }
 
   table_operation operation {table_operation::insert_or_merge_entity(entity)};
-  table_result op_result {table.execute(operation)};
-
-  message.reply(status_codes::OK);
+  const string table_name {paths[1]};
+  table.execute_async(operation)
+    .then([message, table_name, entity] (pplx::task<table_result> result)
+          {
+            try {
+              result.get();
+            }
+            catch (const storage_exception& e) {
+              cout << "Azure Table Storage error: " << e.what() << endl;
+              message.reply(status_codes::InternalError);
+              return;
+            }
+            entity_cache.invalidate(table_name, entity.partition_key(), entity.row_key());
+            message.reply(status_codes::OK);
+          });
   return;
 }
 
 /*
-  Top-level routine for processing all HTTP DELETE requests.
+  Top-level routines for processing HTTP DELETE requests, dispatched
+  by operation name through the DELETE router set up in main().
 
   HTTP URL for this server is defined in this file as http://localhost:34568.
 
@@ -929,75 +1742,141 @@ void handle_put(http_request message) {
       http://localhost:34568/DeleteTableAdmin/TABLE_NAME
     cURL command:
       curl -iX delete URI
-    // TODO: Currently returns status code 500 (Internal Error) if the entity
-    // does not exist; this should be status code 400 (Bad Request).
+    Returns NotFound if the table does not exist.
  */
-void handle_delete(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** DELETE " << path << endl;
-  auto paths = uri::split_path(path);
-  // Need at least an operation and table name
-  if (paths.size() < 2) {
-	message.reply(status_codes::BadRequest);
-	return;
-  }
+void handle_delete_table(http_request message, const vector<string>& paths) {
+  string table_name {paths[1]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  cout << "Delete " << table_name << endl;
+  if_table_exists(message, table_name, [message, table_name, table] ()
+    {
+      cloud_table deleted {table};
+      deleted.delete_table_async()
+        .then([message, table_name] (pplx::task<void> result)
+              {
+                try {
+                  result.get();
+                }
+                catch (const storage_exception& e) {
+                  cout << "Azure Table Storage error: " << e.what() << endl;
+                  message.reply(status_codes::InternalError);
+                  return;
+                }
+                table_cache.delete_entry(table_name);
+                entity_cache.invalidate_table(table_name);
+                message.reply(status_codes::OK);
+              });
+    });
+}
 
+void handle_delete_entity(http_request message, const vector<string>& paths) {
   string table_name {paths[1]};
   cloud_table table {table_cache.lookup_table(table_name)};
 
-  // Delete table
-  if (paths[0] == delete_table_op) {
-    cout << "Delete " << table_name << endl;
-    if ( ! table.exists()) {
-      message.reply(status_codes::NotFound);
-    }
-    table.delete_table();
-    table_cache.delete_entry(table_name);
-    message.reply(status_codes::OK);
-  }
-  // Delete entity
-  else if (paths[0] == delete_entity_admin) {
-    // For delete entity, also need partition and row
-    if (paths.size() < 4) {
-	message.reply(status_codes::BadRequest);
-	return;
-    }
-    table_entity entity {paths[2], paths[3]};
-    cout << "Delete " << entity.partition_key() << " / " << entity.row_key()<< endl;
+  table_entity entity {paths[2], paths[3]};
+  cout << "Delete " << entity.partition_key() << " / " << entity.row_key()<< endl;
+
+  table_operation operation {table_operation::delete_entity(entity)};
+  table.execute_async(operation)
+    .then([message, table_name, entity] (pplx::task<table_result> result)
+          {
+            int code {};
+            try {
+              code = result.get().http_status_code();
+            }
+            catch (const storage_exception& e) {
+              cout << "Azure Table Storage error: " << e.what() << endl;
+              message.reply(status_codes::InternalError);
+              return;
+            }
+            entity_cache.invalidate(table_name, entity.partition_key(), entity.row_key());
+
+            if (code == status_codes::NoContent) {
+              code = status_codes::OK;
+            }
+            message.reply(code);
+          });
+}
 
-    table_operation operation {table_operation::delete_entity(entity)};
-    table_result op_result {table.execute(operation)};
+/*
+  Start the server
+
+  Warm up the table cache and register the handler for each operation,
+  with the number of path segments it takes, in service.
+
+  args: names of the tables to warm up; with no names, every table in
+  the storage account is.
+ */
+void start (Service& service, const vector<string>& args) {
+  cout << "Parsing connection string" << endl;
+  table_cache.init (storage_connection_string, table_recheck_interval);
+
+  // Warm up the tables named on the command line, or every table
+  std::size_t warmed {args.empty() ?
+      table_cache.warm_up_all() :
+      table_cache.warm_up(args)};
+  cout << "Warmed up " << warmed << " tables" << endl;
+
+  Router& get_routes (service.routes(methods::GET));
+  get_routes.add(read_entities_admin, 2, &handle_read_entities);
+  get_routes.add(read_entity_admin, 2, 4, &handle_read_entity);
+  get_routes.add(read_entity_auth, 5, &handle_read_entity);
+
+  Router& post_routes (service.routes(methods::POST));
+  post_routes.add(create_table_op, 2, &handle_create_table);
+
+  Router& put_routes (service.routes(methods::PUT));
+  put_routes.add(update_entities_admin, 2, &handle_update_entities);
+  put_routes.add(update_entity_admin, 4, &handle_update_entity);
+  put_routes.add(update_entity_auth, 5, &handle_update_entity);
+  put_routes.add(append_list_item_auth, 5, &handle_edit_list);
+  put_routes.add(remove_list_item_auth, 5, &handle_edit_list);
+  put_routes.add(add_property_admin, 2, &handle_update_property);
+  put_routes.add(update_property_admin, 2, &handle_update_property);
+
+  Router& delete_routes (service.routes(methods::DEL));
+  delete_routes.add(delete_table_op, 2, &handle_delete_table);
+  delete_routes.add(delete_entity_admin, 4, &handle_delete_entity);
+}
+
+/*
+  Report on the server's caches once its listener has closed
+ */
+void stop () {
+  cout << "Entity cache hits " << entity_cache.hits()
+       << ", misses " << entity_cache.misses() << endl;
+  cout << "Token client pool hits " << token_client_pool.hits()
+       << ", misses " << token_client_pool.misses() << endl;
+}
 
-    int code {op_result.http_status_code()};
-    if (code == status_codes::NoContent) {
-      code = status_codes::OK;
-    }
-    message.reply(code);
-  }
-  else {
-    message.reply(status_codes::BadRequest);
-  }
 }
 
+#ifndef COMBINED_SERVERS
 /*
   Main server routine
 
-  Install handlers for the HTTP requests and open the listener,
-  which processes each request asynchronously.
+  Start the server and open the listener, which processes each
+  request asynchronously.
+
+  Usage: basicserver [TABLE_NAME ...]
+  The named tables are warmed up; with no names, every table in the
+  storage account is.
 
   Wait for a carriage return, then shut the server down.
  */
 int main (int argc, char const * argv[]) {
-  cout << "Parsing connection string" << endl;
-  table_cache.init (storage_connection_string);
+  const auto started = std::chrono::steady_clock::now();
+  Service service {};
+  basic_service::start(service, vector<string> (argv + 1, argv + argc));
 
   cout << "Opening listener" << endl;
   http_listener listener {server_urls::basic_server};
-  listener.support(methods::GET, &handle_get);
-  listener.support(methods::POST, &handle_post);
-  listener.support(methods::PUT, &handle_put);
-  listener.support(methods::DEL, &handle_delete);
+  service.support(listener);
   listener.open().wait(); // Wait for listener to complete starting
+  cout << "Ready after "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()
+       << " ms" << endl;
 
   cout << "Enter carriage return to stop server." << endl;
   string line;
@@ -1005,5 +1884,7 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  basic_service::stop();
   cout << "Closed" << endl;
 }
+#endif
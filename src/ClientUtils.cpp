@@ -10,14 +10,27 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
 #include <string>
 #include <utility>
 
+#include <cpprest/base_uri.h>
+#include <cpprest/containerstream.h>
 #include <cpprest/http_client.h>
 #include <cpprest/json.h>
 
 #include <pplx/pplxtasks.h>
 
+#include "../include/CpprestInternals.h"
+#include "../include/HttpClientPool.h"
+#include "../include/Settings.h"
+
+using concurrency::streams::container_buffer;
+
 using std::make_pair;
 using std::pair;
 using std::string;
@@ -31,11 +44,195 @@ using web::http::method;
 using web::http::status_code;
 using web::http::status_codes;
 
+using web::uri;
+
 using web::http::client::http_client;
 
 using web::json::object;
 using web::json::value;
 
+/*
+  Clients shared by every request this process makes. The number of
+  servers a client is kept for and how long an unused client stays
+  open can be set with the environment variables
+  HTTP_CLIENT_POOL_CAPACITY and HTTP_CLIENT_POOL_IDLE_TIMEOUT (in
+  seconds).
+ */
+constexpr std::size_t default_http_client_pool_capacity {16};
+constexpr std::chrono::seconds default_http_client_pool_idle_timeout {60};
+HttpClientPool http_client_pool {
+  env_size("HTTP_CLIENT_POOL_CAPACITY", default_http_client_pool_capacity),
+  env_seconds("HTTP_CLIENT_POOL_IDLE_TIMEOUT", default_http_client_pool_idle_timeout)
+};
+
+/*
+  Services hosted in this process, by the authority (scheme, host
+  and port) of their server. Only add_local_service() writes it, before
+  any requests are made, so lookups need no lock.
+ */
+static unordered_map<string,std::function<void (http_request)>> local_services {};
+
+void add_local_service (const string& base_url, std::function<void (http_request)> dispatch) {
+  local_services[uri {base_url}.authority().to_string()] = dispatch;
+}
+
+/*
+  The result of a response received over HTTP, whose body has arrived
+ */
+static pplx::task<req_res_t> response_result (http_response response) {
+  const status_code code {response.status_code()};
+  const http_headers& headers {response.headers()};
+  auto content_type (headers.find("Content-Type"));
+  if (content_type == headers.end() ||
+      content_type->second != "application/json")
+    return pplx::task_from_result(make_pair(code, value::object ()));
+  else
+    return response.extract_json()
+      .then([code](value v) { return make_pair(code, v); });
+}
+
+/*
+  Pass request to a service in this process, as a listener would: the
+  service runs on a pool thread, and a handler that throws gets
+  InternalError unless it has already replied.
+
+  Only the network is skipped. Both bodies are still JSON text: the
+  request body was serialized by set_body() and is parsed by the
+  service's get_json_body(), and the reply is parsed here.
+
+  The result is as response_result() gives for the same reply. The
+  reply's body, which the service may still be writing, is read
+  straight from its stream, because extract_json() would wait for a
+  completion that only a client sets. It is then checked and parsed as
+  extract_json() does: a body without Content-Type: application/json
+  gives an empty object, an empty body gives a null value, and a body
+  that is not valid JSON fails the task with web::json::json_exception.
+ */
+static pplx::task<req_res_t> local_request (const std::function<void (http_request)>& dispatch, http_request request) {
+  mark_body_received(request);
+  pplx::create_task([dispatch, request]
+                    {
+                      try {
+                        dispatch(request);
+                      }
+                      catch (const std::exception& e) {
+                        std::cout << "Local request failed: " << e.what() << std::endl;
+                        try {
+                          request.reply(status_codes::InternalError);
+                        }
+                        catch (const web::http::http_exception&) {
+                          // The handler replied before it threw
+                        }
+                      }
+                    });
+
+  return request.get_response()
+    .then([](http_response response) -> pplx::task<req_res_t>
+          {
+            const status_code code {response.status_code()};
+            const http_headers& headers {response.headers()};
+            auto content_type (headers.find("Content-Type"));
+            if (content_type == headers.end() ||
+                content_type->second != "application/json")
+              return pplx::task_from_result(make_pair(code, value::object ()));
+
+            container_buffer<string> body {};
+            return response.body().read_to_end(body)
+              .then([code, body](std::size_t) mutable -> req_res_t
+                    {
+                      const string& text (body.collection());
+                      return make_pair(code, text.empty() ? value {} : value::parse(text));
+                    });
+          });
+}
+
+/*
+  Make an HTTP request, returning a task for the status code and any
+  JSON value in the body
+
+  The arguments and result are as for do_request(), below, but the
+  caller is not blocked: the task completes when the response body
+  has been read, and no thread waits meanwhile. If the request
+  fails, getting the task's result throws, as do_request() does.
+ */
+pplx::task<req_res_t> do_request_async (const method& http_method, const string& uri_string, const value& req_body) {
+  const uri target {uri_string};
+  http_request request {http_method};
+  request.set_request_uri(target.resource());
+  if (req_body != value {}) {
+    http_headers& headers (request.headers());
+    headers.add("Content-Type", "application/json");
+    request.set_body(req_body);
+  }
+
+  auto local (local_services.find(target.authority().to_string()));
+  if (local != local_services.end())
+    return local_request(local->second, request);
+
+  // The task holds its own reference to the client, so an idle
+  // eviction from the pool cannot close it mid-request
+  std::shared_ptr<http_client> client {http_client_pool.lookup_client(target)};
+  return client->request (request)
+    .then([client](http_response response) { return response_result(response); });
+}
+
+pplx::task<req_res_t> do_request_async (const method& http_method, const string& uri_string) {
+  return do_request_async (http_method, uri_string, value {});
+}
+
+/*
+  Sequence two requests: when first completes with status OK, start
+  the request that next makes from its result. Any other result of
+  first is passed on as the result, without calling next, so a chain
+  of hops stops at the first that fails.
+ */
+pplx::task<req_res_t> then_if_ok (pplx::task<req_res_t> first,
+                                  std::function<pplx::task<req_res_t> (const req_res_t&)> next) {
+  return first.then([next](req_res_t result) -> pplx::task<req_res_t>
+                    {
+                      if (result.first != status_codes::OK)
+                        return pplx::task_from_result(result);
+                      return next(result);
+                    });
+}
+
+/*
+  Combine requests already started, so that they run concurrently.
+  The task completes when all of them have: with the first result,
+  in the order of requests, whose status is not OK, or if every
+  status is OK, with OK and an empty object.
+ */
+pplx::task<req_res_t> when_all_ok (const vector<pplx::task<req_res_t>>& requests) {
+  if (requests.empty())
+    return pplx::task_from_result(make_pair(static_cast<status_code>(status_codes::OK), value::object ()));
+  return pplx::when_all(requests.begin(), requests.end())
+    .then([](vector<req_res_t> results) -> req_res_t
+          {
+            for (const auto& result : results) {
+              if (result.first != status_codes::OK)
+                return result;
+            }
+            return make_pair(static_cast<status_code>(status_codes::OK), value::object ());
+          });
+}
+
+/*
+  For a server handling message: get the result of request, a call
+  it made to another service. If the call failed, log why, reply
+  InternalError to message and return false.
+ */
+bool get_request_result (pplx::task<req_res_t> request, http_request message, req_res_t& result) {
+  try {
+    result = request.get();
+    return true;
+  }
+  catch (const std::exception& e) {
+    std::cout << "Request failed: " << e.what() << std::endl;
+    message.reply(status_codes::InternalError);
+    return false;
+  }
+}
+
 /*
   Make an HTTP request, returning the status code and any JSON value in the body
 
@@ -62,6 +259,10 @@ using web::json::value;
   ambiguous in some edge cases that don't matter for these
   assignments.
 
+  Requests to the same scheme, host and port share a client from
+  http_client_pool, and so reuse its open connections. Requests to a
+  server registered with add_local_service() do not go over HTTP.
+
   You're welcome to read this code but bear in mind: It's the single
   trickiest part of the sample code. You can just call it without
   attending to its internals, if you prefer.
@@ -69,35 +270,7 @@ using web::json::value;
 
 // Version with explicit third argument
 pair<status_code,value> do_request (const method& http_method, const string& uri_string, const value& req_body) {
-  http_request request {http_method};
-  if (req_body != value {}) {
-    http_headers& headers (request.headers());
-    headers.add("Content-Type", "application/json");
-    request.set_body(req_body);
-  }
-
-  status_code code;
-  value resp_body;
-  http_client client {uri_string};
-  client.request (request)
-    .then([&code](http_response response)
-          {
-            code = response.status_code();
-            const http_headers& headers {response.headers()};
-            auto content_type (headers.find("Content-Type"));
-            if (content_type == headers.end() ||
-                content_type->second != "application/json")
-              return pplx::task<value> ([] { return value::object ();});
-            else
-              return response.extract_json();
-          })
-    .then([&resp_body](value v) -> void
-          {
-            resp_body = v;
-            return;
-          })
-    .wait();
-  return make_pair(code, resp_body);
+  return do_request_async (http_method, uri_string, req_body).get();
 }
 
 // Version that defaults third argument
@@ -0,0 +1,100 @@
+/*
+  All four servers in a single process.
+
+  Each server listens on its usual URL, as defined in ServerUrls.h,
+  so clients see the same HTTP interface as with four processes. The
+  calls the servers make to one another do not go over HTTP: each
+  server is registered with add_local_service(), so do_request()
+  passes its in-memory request straight to that server's routes.
+  This saves the connection and the socket round trip, not the JSON
+  encoding: request and reply bodies are serialized and parsed as
+  they are over HTTP.
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cpprest/http_listener.h>
+
+#include <pplx/pplxtasks.h>
+
+#include "../include/ClientUtils.h"
+#include "../include/make_unique.h"
+#include "../include/Router.h"
+#include "../include/ServerUrls.h"
+#include "../include/Services.h"
+
+using std::cout;
+using std::endl;
+using std::getline;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+using web::http::http_request;
+
+using web::http::experimental::listener::http_listener;
+
+/*
+  Main combined server routine
+
+  Start the servers, each with its default arguments, register each
+  as a local service, and open their listeners.
+
+  Wait for a carriage return, then shut the servers down in the
+  reverse order.
+ */
+int main () {
+  const auto started = std::chrono::steady_clock::now();
+  const vector<string> no_args {};
+
+  Service basic {};
+  Service auth {};
+  Service user {};
+  Service push {};
+  basic_service::start(basic, no_args);
+  auth_service::start(auth, no_args);
+  user_service::start(user, no_args);
+  push_service::start(push, no_args);
+
+  const vector<std::pair<string,const Service*>> servers {
+    {server_urls::basic_server, &basic},
+    {server_urls::auth_server, &auth},
+    {server_urls::user_server, &user},
+    {server_urls::push_server, &push}
+  };
+
+  vector<unique_ptr<http_listener>> listeners {};
+  for (const auto& server : servers) {
+    const Service* service {server.second};
+    add_local_service(server.first, [service] (http_request message) { service->dispatch(message); });
+    listeners.push_back(std::make_unique<http_listener>(server.first));
+    service->support(*listeners.back());
+  }
+
+  cout << "Opening listeners" << endl;
+  for (auto& listener : listeners)
+    listener->open().wait(); // Wait for listener to complete starting
+  cout << "Ready after "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()
+       << " ms" << endl;
+
+  cout << "Enter carriage return to stop servers." << endl;
+  string line;
+  getline(std::cin, line);
+
+  // Shut them down
+  for (auto& listener : listeners)
+    listener->close().wait();
+  push_service::stop();
+  user_service::stop();
+  auth_service::stop();
+  basic_service::stop();
+  cout << "HTTP client pool hits " << http_client_pool.hits()
+       << ", misses " << http_client_pool.misses() << endl;
+  cout << "Closed" << endl;
+}
@@ -0,0 +1,24 @@
+#include "../include/CpprestInternals.h"
+
+#include <chrono>
+#include <memory>
+
+#include <cpprest/http_msg.h>
+
+#include <pplx/pplxtasks.h>
+#include <pplx/threadpool.h>
+
+#include <boost/asio/deadline_timer.hpp>
+
+pplx::task<void> after_delay (std::chrono::milliseconds delay) {
+  auto timer = std::make_shared<boost::asio::deadline_timer>(
+    crossplat::threadpool::shared_instance().service(),
+    boost::posix_time::milliseconds {delay.count()});
+  pplx::task_completion_event<void> expired {};
+  timer->async_wait([timer, expired] (const boost::system::error_code&) { expired.set(); });
+  return pplx::create_task(expired);
+}
+
+void mark_body_received (web::http::http_request request) {
+  request._get_impl()->_complete(request.headers().content_length());
+}
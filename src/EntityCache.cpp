@@ -0,0 +1,113 @@
+#include "../include/EntityCache.h"
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <was/table.h>
+
+using azure::storage::table_entity;
+
+using pplx::extensibility::scoped_critical_section_t;
+
+using std::string;
+
+constexpr std::size_t EntityCache::shard_count;
+
+/*
+  Azure does not allow '/' in partition or row keys, nor in table names,
+  so joining the three with '/' gives a unique key.
+ */
+static string make_key(const string& table_name, const string& partition, const string& row) {
+  return table_name + '/' + partition + '/' + row;
+}
+
+EntityCache::shard_t& EntityCache::shard_for(const string& key) {
+  return shards[std::hash<string>{}(key) % shard_count];
+}
+
+// Caller must hold shard.lock
+void EntityCache::erase(shard_t& shard, std::unordered_map<string,entry_t>::iterator entry) {
+  shard.lru.erase(entry->second.position);
+  shard.entries.erase(entry);
+}
+
+bool EntityCache::lookup(const string& table_name,
+                         const string& partition,
+                         const string& row,
+                         table_entity& entity,
+                         ticket_t& ticket) {
+  const string key {make_key(table_name, partition, row)};
+  shard_t& shard (shard_for(key));
+  scoped_critical_section_t lock {shard.lock};
+
+  auto entry (shard.entries.find(key));
+  if (entry != shard.entries.end() && entry->second.expires <= cache_clock::now()) {
+    erase(shard, entry);
+    entry = shard.entries.end();
+  }
+  if (entry == shard.entries.end()) {
+    ++miss_count;
+    ticket = shard.invalidations;
+    return false;
+  }
+
+  ++hit_count;
+  shard.lru.splice(shard.lru.begin(), shard.lru, entry->second.position);
+  entity = entry->second.entity;
+  return true;
+}
+
+void EntityCache::insert(const string& table_name,
+                         const string& partition,
+                         const string& row,
+                         const table_entity& entity,
+                         ticket_t ticket) {
+  const string key {make_key(table_name, partition, row)};
+  shard_t& shard (shard_for(key));
+  scoped_critical_section_t lock {shard.lock};
+
+  // Entity may have been changed since it was read
+  if (ticket != shard.invalidations)
+    return;
+
+  auto entry (shard.entries.find(key));
+  if (entry != shard.entries.end())
+    erase(shard, entry);
+  while (shard.entries.size() >= shard_capacity)
+    erase(shard, shard.entries.find(shard.lru.back()));
+
+  shard.lru.push_front(key);
+  shard.entries.emplace(key, entry_t {entity, cache_clock::now() + ttl, shard.lru.begin()});
+}
+
+void EntityCache::invalidate(const string& table_name,
+                             const string& partition,
+                             const string& row) {
+  const string key {make_key(table_name, partition, row)};
+  shard_t& shard (shard_for(key));
+  scoped_critical_section_t lock {shard.lock};
+
+  ++shard.invalidations;
+  auto entry (shard.entries.find(key));
+  if (entry != shard.entries.end())
+    erase(shard, entry);
+}
+
+void EntityCache::invalidate_table(const string& table_name) {
+  const string prefix {table_name + '/'};
+  for (auto& shard : shards) {
+    scoped_critical_section_t lock {shard.lock};
+
+    ++shard.invalidations;
+    for (auto entry = shard.entries.begin(); entry != shard.entries.end(); ) {
+      if (entry->first.compare(0, prefix.size(), prefix) == 0) {
+        shard.lru.erase(entry->second.position);
+        entry = shard.entries.erase(entry);
+      }
+      else {
+        ++entry;
+      }
+    }
+  }
+}
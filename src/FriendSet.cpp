@@ -0,0 +1,77 @@
+#include "../include/FriendSet.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using std::string;
+
+string FriendSet::key(const string& country, const string& name) {
+  string k {};
+  k.reserve(country.size() + 1 + name.size());
+  k += country;
+  k += pair_delimiter;
+  k += name;
+  return k;
+}
+
+/*
+  Follows the rules of parse_friends_list(), but in a single pass
+  that copies each pair once, straight into the set.
+ */
+FriendSet::FriendSet(const string& friends_list) : members {}, order {} {
+  using pos_t = string::size_type;
+
+  pos_t start {0};
+  if ( ! friends_list.empty() && friends_list[start] == pair_separator)
+    start++; // Skip any initial separator
+  for (pos_t delim {friends_list.find(pair_delimiter, start)};
+       delim != string::npos;
+       delim = friends_list.find(pair_delimiter, start)) {
+    pos_t end {friends_list.find(pair_separator, start)};
+    if (end == string::npos)
+      end = friends_list.size();
+    if (end <= delim+1)
+      throw std::invalid_argument(string("Misformed friends list: ") + friends_list);
+    string member (friends_list, start, end-start);
+    if (members.insert(member).second)
+      order.push_back(std::move(member));
+    start = end+1;
+  }
+}
+
+bool FriendSet::insert(const string& country, const string& name) {
+  string member {key(country, name)};
+  if ( ! members.insert(member).second)
+    return false;
+  order.push_back(std::move(member));
+  return true;
+}
+
+bool FriendSet::erase(const string& country, const string& name) {
+  const string member {key(country, name)};
+  if (members.erase(member) == 0)
+    return false;
+  order.erase(std::find(order.begin(), order.end(), member));
+  return true;
+}
+
+bool FriendSet::contains(const string& country, const string& name) const {
+  return members.count(key(country, name)) > 0;
+}
+
+friends_list_t FriendSet::list() const {
+  friends_list_t friends {};
+  friends.reserve(order.size());
+  for (const auto& member : order) {
+    // A country never contains pair_delimiter, so the first one splits the pair
+    const string::size_type delim {member.find(pair_delimiter)};
+    friends.push_back(std::make_pair(member.substr(0, delim), member.substr(delim+1)));
+  }
+  return friends;
+}
+
+string FriendSet::to_string() const {
+  return friends_list_to_string(list());
+}
@@ -0,0 +1,61 @@
+#include "../include/HttpClientPool.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <cpprest/base_uri.h>
+#include <cpprest/http_client.h>
+
+using pplx::extensibility::scoped_critical_section_t;
+
+using std::string;
+
+using web::uri;
+
+using web::http::client::http_client;
+
+// Caller must hold lock
+void HttpClientPool::erase(std::unordered_map<string,entry_t>::iterator entry) {
+  lru.erase(entry->second.position);
+  entries.erase(entry);
+}
+
+std::shared_ptr<http_client> HttpClientPool::lookup_client(const uri& target) {
+  const uri authority {target.authority()};
+  const string key {authority.to_string()};
+  const pool_clock::time_point now {pool_clock::now()};
+  {
+    scoped_critical_section_t l {lock};
+    // Close clients idle for too long, oldest first
+    while ( ! lru.empty()) {
+      auto oldest (entries.find(lru.back()));
+      if (now - oldest->second.last_used < idle_timeout)
+        break;
+      erase(oldest);
+    }
+
+    auto entry (entries.find(key));
+    if (entry != entries.end()) {
+      ++hit_count;
+      entry->second.last_used = now;
+      lru.splice(lru.begin(), lru, entry->second.position);
+      return entry->second.client;
+    }
+  }
+
+  // Build outside the lock; a concurrent miss on the same key
+  // just replaces this entry
+  ++miss_count;
+  auto client (std::make_shared<http_client>(authority));
+
+  scoped_critical_section_t l {lock};
+  auto entry (entries.find(key));
+  if (entry != entries.end())
+    erase(entry);
+  while (entries.size() >= capacity)
+    erase(entries.find(lru.back()));
+  lru.push_front(key);
+  entries.emplace(key, entry_t {client, now, lru.begin()});
+  return client;
+}
@@ -0,0 +1,262 @@
+#include "../include/JsonBody.h"
+
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+#include <pplx/pplxtasks.h>
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::unordered_map;
+
+using web::http::http_headers;
+using web::http::http_request;
+using web::http::status_codes;
+
+using web::json::value;
+
+namespace {
+
+void skip_space(const string& text, string::size_type& pos) {
+  while (pos < text.size() &&
+         (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+    ++pos;
+}
+
+// Read 4 hex digits at pos into code
+bool parse_hex4(const string& text, string::size_type& pos, unsigned& code) {
+  if (text.size() - pos < 4)
+    return false;
+  code = 0;
+  for (int i {0}; i < 4; ++i, ++pos) {
+    const char c {text[pos]};
+    code <<= 4;
+    if (c >= '0' && c <= '9')
+      code |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      code |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      code |= c - 'A' + 10;
+    else
+      return false;
+  }
+  return true;
+}
+
+void append_utf8(string& out, unsigned code) {
+  if (code < 0x80) {
+    out += static_cast<char>(code);
+  }
+  else if (code < 0x800) {
+    out += static_cast<char>(0xc0 | (code >> 6));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  }
+  else if (code < 0x10000) {
+    out += static_cast<char>(0xe0 | (code >> 12));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  }
+  else {
+    out += static_cast<char>(0xf0 | (code >> 18));
+    out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+    out += static_cast<char>(0x80 | (code & 0x3f));
+  }
+}
+
+/*
+  Parse the JSON string starting at the quote at pos into out,
+  leaving pos after the closing quote. Runs without escapes are
+  appended in one piece.
+ */
+bool parse_string(const string& text, string::size_type& pos, string& out) {
+  if (pos >= text.size() || text[pos] != '"')
+    return false;
+  ++pos;
+  out.clear();
+  while (pos < text.size()) {
+    string::size_type run {pos};
+    while (run < text.size() && text[run] != '"' && text[run] != '\\' &&
+           static_cast<unsigned char>(text[run]) >= 0x20)
+      ++run;
+    out.append(text, pos, run - pos);
+    pos = run;
+    if (pos >= text.size())
+      return false;
+
+    const char c {text[pos++]};
+    if (c == '"')
+      return true;
+    if (c != '\\' || pos >= text.size())
+      return false;  // Unescaped control character or truncated escape
+
+    const char e {text[pos++]};
+    switch (e) {
+      case '"':  out += '"'; break;
+      case '\\': out += '\\'; break;
+      case '/':  out += '/'; break;
+      case 'b':  out += '\b'; break;
+      case 'f':  out += '\f'; break;
+      case 'n':  out += '\n'; break;
+      case 'r':  out += '\r'; break;
+      case 't':  out += '\t'; break;
+      case 'u': {
+        unsigned code;
+        if (!parse_hex4(text, pos, code))
+          return false;
+        // Combine a surrogate pair into one code point
+        if (code >= 0xd800 && code < 0xdc00) {
+          unsigned low;
+          if (text.compare(pos, 2, "\\u") != 0)
+            return false;
+          pos += 2;
+          if (!parse_hex4(text, pos, low) || low < 0xdc00 || low >= 0xe000)
+            return false;
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        }
+        else if (code >= 0xdc00 && code < 0xe000) {
+          return false;
+        }
+        append_utf8(out, code);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return false;
+}
+
+}  // Unnamed namespace
+
+bool parse_flat_json_object(const string& text, unordered_map<string,string>& results) {
+  string::size_type pos {0};
+  skip_space(text, pos);
+  if (pos >= text.size() || text[pos] != '{')
+    return false;
+  ++pos;
+  skip_space(text, pos);
+
+  string key {};
+  string val {};
+  if (pos < text.size() && text[pos] == '}') {
+    ++pos;
+  }
+  else {
+    while (true) {
+      if (!parse_string(text, pos, key))
+        return false;
+      skip_space(text, pos);
+      if (pos >= text.size() || text[pos] != ':')
+        return false;
+      ++pos;
+      skip_space(text, pos);
+      // Any value other than a string needs the full parser
+      if (!parse_string(text, pos, val))
+        return false;
+      results[key] = val;
+      skip_space(text, pos);
+      if (pos >= text.size())
+        return false;
+      if (text[pos] == '}') {
+        ++pos;
+        break;
+      }
+      if (text[pos] != ',')
+        return false;
+      ++pos;
+      skip_space(text, pos);
+    }
+  }
+  skip_space(text, pos);
+  return pos == text.size();
+}
+
+bool has_json_body (http_request message) {
+  return message.headers()["Content-type"] == "application/json";
+}
+
+namespace {
+
+bool is_json_content(http_request message) {
+  const http_headers& headers {message.headers()};
+  auto content_type (headers.find("Content-Type"));
+  return content_type != headers.end() &&
+    content_type->second == "application/json";
+}
+
+// Fill results, which must be empty, from the text of a JSON body
+void parse_json_body(const string& text, unordered_map<string,string>& results) {
+  if (parse_flat_json_object(text, results))
+    return;
+
+  // Nested or non-string values: parse fully and serialize them
+  results.clear();
+  value json {value::parse(text)};
+  if (json.is_object()) {
+    for (const auto& v : json.as_object()) {
+      if (v.second.is_string()) {
+        results[v.first] = v.second.as_string();
+      }
+      else {
+        results[v.first] = v.second.serialize();
+      }
+    }
+  }
+}
+
+}
+
+void get_json_body(http_request message, unordered_map<string,string>& results) {
+  results.clear();
+  if ( ! is_json_content(message))
+    return;
+  parse_json_body(message.extract_string(true).get(), results);
+}
+
+pplx::task<unordered_map<string,string>> get_json_body_async(http_request message) {
+  if ( ! is_json_content(message))
+    return pplx::task_from_result(unordered_map<string,string> {});
+  return message.extract_string(true)
+    .then([] (string text)
+          {
+            unordered_map<string,string> results {};
+            parse_json_body(text, results);
+            return results;
+          });
+}
+
+void with_json_body(http_request message,
+                    std::function<void (const unordered_map<string,string>&)> use) {
+  get_json_body_async(message)
+    .then([message, use] (pplx::task<unordered_map<string,string>> body)
+          {
+            unordered_map<string,string> json_body {};
+            try {
+              json_body = body.get();
+            }
+            catch (const std::exception& e) {
+              cout << e.what() << endl;
+              message.reply(status_codes::BadRequest);
+              return;
+            }
+            use(json_body);
+          });
+}
+
+unordered_map<string,string> get_json_body(http_request message) {
+  unordered_map<string,string> results {};
+  get_json_body(message, results);
+  return results;
+}
+
+unordered_map<string,string> get_json_bourne(http_request message) {
+ return get_json_body(message);
+}
@@ -32,8 +32,12 @@
 #include <was/table.h>
 
 #include "../include/ClientUtils.h"
+#include "../include/FriendSet.h"
+#include "../include/JsonBody.h"
+#include "../include/Router.h"
 #include "../include/ServerUrls.h"
 #include "../include/ServerUtils.h"
+#include "../include/Services.h"
 
 using azure::storage::cloud_storage_account;
 using azure::storage::storage_credentials;
@@ -74,95 +78,28 @@ using web::http::experimental::listener::http_listener;
 
 using friends_list_t = std::vector<std::pair<std::string,std::string>>;
 
+namespace push_service {
+
 constexpr const char* basic_url = "http://localhost:34568/";
 constexpr const char* def_url = "http://localhost:34574/";
 
 const string push_status_op {"PushStatus"};
-const string read_entity_admin {"ReadEntityAdmin"};
+const string read_entities_admin {"ReadEntitiesAdmin"};
 const string update_entity_admin {"UpdateEntityAdmin"};
 
 const string data_table_name {"DataTable"};
 
-//---------------------------------------------------------------------------------------
-
-/*
-  Return true if an HTTP request has a JSON body
-
-  This routine can be called multiple times on the same message.
- */
-bool has_json_body (http_request message) {
-  return message.headers()["Content-type"] == "application/json";
-}
-
-/*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-  get_json_body and get_json_bourne are valid and identical function calls.
-
-  If the message has no JSON body, return an empty map.
-
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
-
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
- */
-unordered_map<string,string> get_json_body(http_request message) {
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
-
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-          {
-            json = v;
-            return true;
-          })
-    .wait();
-
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-        results[v.first] = v.second.as_string();
-      }
-      else {
-        results[v.first] = v.second.serialize();
-      }
-    }
-  }
-  return results;
-}
-
-unordered_map<string,string> get_json_bourne(http_request message) {
- return get_json_body(message);
-}
-
+// Friends updated at once, so that a long friends list cannot flood
+// BasicServer with requests
+constexpr std::size_t max_concurrent_pushes {32};
 
 //---------------------------------------------------------------------------------------
 
-void handle_post (http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
-  auto paths = uri::split_path(path);
-
-  // need operation name, country, username, status = 4
-  if (paths.size() != 4 ) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  //no PushStatus included
-  else if(paths[0] != push_status_op) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
+// Dispatched through the POST router set up in main(), which
+// checks for operation name, country, username, status = 4
+void handle_push_status (http_request message, const vector<string>& paths) {
   // no friends body included
-  else if(!has_json_body(message)) {
+  if(!has_json_body(message)) {
     message.reply(status_codes::BadRequest);
     return;
   }
@@ -184,50 +121,103 @@ void handle_post (http_request message) {
     message.reply(status_codes::BadRequest);
     return;
   }
-  vector<pair<string,string>> friends_list { parse_friends_list(json_body_friends_iterator->second) };
-  string old_updates;
-  string new_updates;
-  pair<status_code,value> result;
-  vector<pair<string,value>> update_property;
-
-  for ( int i = 0; i < friends_list.size(); i++ ){
-    cout << "in loop friend # " << i << endl;
-    // get properties of entity
-    result = do_request(methods::GET, basic_url
-      + read_entity_admin + "/"
-      + data_table_name + "/"
-      + string(friends_list[i].first) + "/"
-      + string(friends_list[i].second) );
-
-    //get old updates
-
-    old_updates = get_json_object_prop(result.second, "Updates");
-    cout << "Old Statuses: " << old_updates << endl;
-
-    //add new update
-    new_updates = string(paths[3]) + "\n" + old_updates;
-    update_property.push_back( make_pair("Updates", value::string(new_updates) ) );
-    //update property of friend
-    result = do_request(methods::PUT, basic_url
-      + update_entity_admin + "/"
-      + data_table_name + "/"
-      + string(friends_list[i].first) + "/"
-      + string(friends_list[i].second), value::object(update_property) );
-
-    update_property.clear();
-    cout << "Updated Statuses: " << new_updates << endl;
+  // Push each friend once, even if the list names them twice
+  vector<pair<string,string>> friends_list { FriendSet {json_body_friends_iterator->second}.list() };
+
+  // get properties of all friends' entities in one request
+  vector<value> friend_keys;
+  for ( const auto& f : friends_list ){
+    friend_keys.push_back( build_json_value("Partition", f.first, "Row", f.second) );
   }
+  const string status {paths[3]};
+  do_request_async(methods::GET, basic_url
+    + read_entities_admin + "/"
+    + data_table_name, value::array(friend_keys) )
+    .then([friends_list, status] (pplx::task<req_res_t> request) -> pplx::task<req_res_t> {
+      req_res_t result {request.get()};
+      if ( result.first != status_codes::OK || !result.second.is_array() ||
+           result.second.as_array().size() != friends_list.size() ){
+        return pplx::task_from_result(make_pair(static_cast<status_code>(status_codes::InternalError),
+                                                value::object()));
+      }
+      const web::json::array& friend_entities = result.second.as_array();
+
+      // The URL and body of the update of each friend's entity
+      auto pushes = std::make_shared<vector<pair<string,value>>>();
+      for ( std::size_t i = 0; i < friends_list.size(); i++ ){
+        //get old updates
+        string old_updates;
+        const value& friend_entity = friend_entities.at(i);
+        if ( friend_entity.has_field("Entity") ){
+          old_updates = get_json_object_prop(friend_entity.at("Entity"), "Updates");
+        }
+
+        //add new update
+        string new_updates {status + "\n" + old_updates};
+        vector<pair<string,value>> update_property;
+        update_property.push_back( make_pair("Updates", value::string(new_updates) ) );
+        //update property of friend
+        pushes->push_back( make_pair(basic_url
+          + update_entity_admin + "/"
+          + data_table_name + "/"
+          + string(friends_list[i].first) + "/"
+          + string(friends_list[i].second), value::object(update_property) ) );
+      }
 
-  message.reply(status_codes::OK);
-  return;
+      // The friends' entities are independent, so update them in
+      // waves of max_concurrent_pushes, pushing to every friend even
+      // if some updates fail, and report the first failure
+      auto first_failure = std::make_shared<req_res_t>(
+        make_pair(static_cast<status_code>(status_codes::OK), value::object()));
+      pplx::task<void> waves {pplx::task_from_result()};
+      for ( std::size_t wave = 0; wave < pushes->size(); wave += max_concurrent_pushes ){
+        waves = waves.then([pushes, wave, first_failure] () {
+          vector<pplx::task<req_res_t>> updates;
+          for ( std::size_t i = wave; i < pushes->size() && i < wave + max_concurrent_pushes; i++ ){
+            updates.push_back( do_request_async(methods::PUT, (*pushes)[i].first, (*pushes)[i].second) );
+            cout << "Pushing status to friend # " << i << endl;
+          }
+          return when_all_ok(updates)
+            .then([first_failure] (req_res_t result) {
+              if ( first_failure->first == status_codes::OK && result.first != status_codes::OK ){
+                *first_failure = result;
+              }
+            });
+        });
+      }
+      return waves.then([first_failure] () { return *first_failure; });
+    })
+    .then([message] (pplx::task<req_res_t> request) {
+      req_res_t result;
+      if ( get_request_result(request, message, result) ){
+        message.reply(result.first);
+      }
+    });
+}
+
+/*
+  Register the push server's one operation in service. The push
+  server takes no arguments and has nothing to do when it stops.
+ */
+void start (Service& service, const vector<string>&) {
+  Router& post_routes (service.routes(methods::POST)); // Push a status update to friends
+  post_routes.add(push_status_op, 4, &handle_push_status);
 }
 
+void stop () {}
+
+}
+
+#ifndef COMBINED_SERVERS
 int main (int argc, char const * argv[]) {
   cout << "Parsing connection string" << endl;
 
   cout << "Opening listener" << endl;
+  Service service {};
+  push_service::start(service, vector<string> (argv + 1, argv + argc));
+
   http_listener listener {server_urls::push_server};
-  listener.support(methods::POST, &handle_post); // Push a status update to friends
+  service.support(listener);
   listener.open().wait();
 
   cout << "Enter carriage return to stop server." << endl;
@@ -236,5 +226,9 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  push_service::stop();
+  cout << "HTTP client pool hits " << http_client_pool.hits()
+       << ", misses " << http_client_pool.misses() << endl;
   cout << "Closed" << endl;
 }
+#endif
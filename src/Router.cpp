@@ -0,0 +1,110 @@
+#include "../include/Router.h"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cpprest/base_uri.h>
+#include <cpprest/http_listener.h>
+
+using std::cout;
+using std::endl;
+using std::string;
+
+using web::http::http_request;
+using web::http::http_response;
+using web::http::status_codes;
+using web::http::uri;
+
+using web::http::experimental::listener::http_listener;
+
+void Router::add(const string& operation,
+                 std::size_t min_paths, std::size_t max_paths,
+                 handler_t handler) {
+  // The operation name is itself a segment
+  if (min_paths < 1 || min_paths > max_paths) {
+    throw std::invalid_argument ("Error: Router::add() was given invalid "\
+      "path counts for " + operation + ".\n");
+  }
+  if ( ! routes.emplace(operation, route_t {min_paths, max_paths, handler}).second) {
+    throw std::invalid_argument ("Error: Router::add() was given the "\
+      "operation " + operation + " twice.\n");
+  }
+}
+
+/*
+  Split an undecoded path into decoded segments, dropping empty ones
+  as uri::split_path() does.
+ */
+Router::paths_t Router::split_path(const string& undecoded_path) {
+  paths_t paths {};
+  string::size_type start {0};
+  while (start <= undecoded_path.size()) {
+    string::size_type end {undecoded_path.find('/', start)};
+    if (end == string::npos)
+      end = undecoded_path.size();
+    if (end > start)
+      paths.push_back(uri::decode(undecoded_path.substr(start, end - start)));
+    start = end + 1;
+  }
+  return paths;
+}
+
+void Router::dispatch(http_request message) const {
+  const string path {message.relative_uri().path()};
+  cout << endl << "**** " << message.method() << " " << uri::decode(path) << endl;
+
+  if ( ! dispatched.exchange(true)) {
+    const auto started = std::chrono::steady_clock::now();
+    const auto method = message.method();
+    message.get_response()
+      .then([started, method] (pplx::task<http_response> response)
+            {
+              try {
+                response.wait();
+              }
+              catch (const std::exception&) {
+                // Latency is logged however the request ended
+              }
+              const auto elapsed = std::chrono::steady_clock::now() - started;
+              cout << "First " << method << " request took "
+                   << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+                   << " ms" << endl;
+            });
+  }
+
+  const paths_t paths {split_path(path)};
+  if (paths.empty()) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+
+  auto route (routes.find(paths[0]));
+  if (route == routes.end() ||
+      paths.size() < route->second.min_paths ||
+      paths.size() > route->second.max_paths) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+  route->second.handler(message, paths);
+}
+
+void Service::dispatch(http_request message) const {
+  auto router (routers.find(message.method()));
+  if (router == routers.end()) {
+    message.reply(status_codes::MethodNotAllowed);
+    return;
+  }
+  router->second.dispatch(message);
+}
+
+// Routers are never removed, so the references the listener holds stay valid
+void Service::support(http_listener& listener) const {
+  for (const auto& router : routers) {
+    const Router& routes (router.second);
+    listener.support(router.first, [&routes] (http_request message) { routes.dispatch(message); });
+  }
+}
@@ -0,0 +1,114 @@
+#include "../include/SasToken.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <ratio>
+#include <string>
+
+#include <cpprest/asyncrt_utils.h>
+#include <cpprest/base_uri.h>
+
+using std::string;
+
+using web::http::uri;
+
+static bool equal_ignoring_case(const string& a, const string& b) {
+  return a.size() == b.size() &&
+    std::equal(a.begin(), a.end(), b.begin(),
+               [] (char x, char y) {
+                 return std::tolower(static_cast<unsigned char>(x)) ==
+                   std::tolower(static_cast<unsigned char>(y));
+               });
+}
+
+bool parse_sas_token(const string& token, sas_token_t& fields) {
+  fields = sas_token_t {};
+  string::size_type start {token.empty() || token[0] != '?' ? 0u : 1u};
+  while (start < token.size()) {
+    string::size_type end {token.find('&', start)};
+    if (end == string::npos)
+      end = token.size();
+    const string::size_type equals {token.find('=', start)};
+    if (equals < end) {
+      const string name {token.substr(start, equals - start)};
+      const string val {uri::decode(token.substr(equals + 1, end - equals - 1))};
+      if (name == "tn")
+        fields.table = val;
+      else if (name == "sp")
+        fields.permissions = val;
+      else if (name == "si")
+        fields.policy = val;
+      else if (name == "spk")
+        fields.start_partition = val;
+      else if (name == "srk")
+        fields.start_row = val;
+      else if (name == "epk")
+        fields.end_partition = val;
+      else if (name == "erk")
+        fields.end_row = val;
+      else if (name == "sig")
+        fields.has_signature = ! val.empty();
+      else if (name == "se") {
+        fields.expiry = utility::datetime::from_string(val, utility::datetime::ISO_8601);
+        if ( ! fields.expiry.is_initialized())
+          return false;
+      }
+    }
+    start = end + 1;
+  }
+  return fields.has_signature &&
+    ( ! fields.permissions.empty() || ! fields.policy.empty());
+}
+
+bool sas_checkable(const sas_token_t& fields) {
+  return fields.policy.empty() || ! fields.permissions.empty();
+}
+
+bool sas_allows(const sas_token_t& fields, char permission) {
+  return fields.permissions.find(permission) != string::npos;
+}
+
+bool sas_covers(const sas_token_t& fields,
+                const string& table,
+                const string& partition,
+                const string& row,
+                const utility::datetime& now) {
+  if (fields.expiry.is_initialized() && fields.expiry.to_interval() <= now.to_interval())
+    return false;
+  if ( ! fields.table.empty() && ! equal_ignoring_case(fields.table, table))
+    return false;
+
+  // The range is inclusive, ordered by partition and then row
+  if ( ! fields.start_partition.empty()) {
+    if (partition < fields.start_partition)
+      return false;
+    if (partition == fields.start_partition &&
+        ! fields.start_row.empty() && row < fields.start_row)
+      return false;
+  }
+  if ( ! fields.end_partition.empty()) {
+    if (partition > fields.end_partition)
+      return false;
+    if (partition == fields.end_partition &&
+        ! fields.end_row.empty() && row > fields.end_row)
+      return false;
+  }
+  return true;
+}
+
+std::chrono::steady_clock::duration sas_lifetime(const string& token,
+                                                 std::chrono::steady_clock::duration fallback) {
+  sas_token_t fields;
+  parse_sas_token(token, fields);
+  if ( ! fields.expiry.is_initialized())
+    return fallback;
+
+  const utility::datetime now {utility::datetime::utc_now()};
+  if (fields.expiry.to_interval() <= now.to_interval())
+    return std::chrono::steady_clock::duration::zero();
+  // datetime intervals are in units of 100 ns
+  const std::chrono::duration<unsigned long long, std::ratio<1, 10000000>>
+    remaining {fields.expiry.to_interval() - now.to_interval()};
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(remaining);
+}
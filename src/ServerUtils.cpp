@@ -4,18 +4,22 @@
 
 #include "../include/ServerUtils.h"
 
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <pplx/pplxtasks.h>
+
 #include <was/table.h>
 
+#include "../include/SasToken.h"
+#include "../include/TokenClientPool.h"
+
 using azure::storage::cloud_table;
-using azure::storage::cloud_table_client;
 using azure::storage::entity_property;
-using azure::storage::storage_credentials;
 using azure::storage::storage_exception;
 using azure::storage::table_entity;
 using azure::storage::table_operation;
@@ -34,6 +38,64 @@ using web::http::status_code;
 using web::http::status_codes;
 using web::http::uri;
 
+constexpr std::size_t token_pool_capacity {1000};
+// Lifetime of a pooled client whose token has no readable expiry
+constexpr std::chrono::minutes token_pool_fallback_ttl {15};
+TokenClientPool token_client_pool {token_pool_capacity, token_pool_fallback_ttl};
+
+/*
+  Log a storage exception from a token operation and return the
+  status code to report for it: Forbidden if Azure rejected the
+  token, InternalError otherwise.
+ */
+static status_code storage_error_status (const storage_exception& e) {
+  cout << "Azure Table Storage error: " << e.what() << endl;
+  cout << e.result().extended_error().message() << endl;
+  if (e.result().http_status_code() == status_codes::Forbidden)
+    return status_codes::Forbidden;
+  else
+    return status_codes::InternalError;
+}
+
+/*
+  Check a token against the entity it is used for, before asking Azure.
+
+  token, tname, partition and row are undecoded path segments.
+  permission is the SAS permission the operation needs ('r' or 'u').
+
+  Returns:
+    OK if Azure might accept the token
+    Forbidden if the token does not grant permission
+    NotFound if the token is not a SAS, has expired, or is for
+      another table or range of entities
+
+  A token that takes its permissions from a stored access policy is
+  left to Azure, as the policy may also set its expiry.
+ */
+static status_code check_token (const string& token,
+                                const string& tname,
+                                const string& partition,
+                                const string& row,
+                                char permission) {
+  sas_token_t fields;
+  if ( ! parse_sas_token (token, fields)) {
+    cout << "Rejected token: not a SAS" << endl;
+    return status_codes::NotFound;
+  }
+  if ( ! sas_checkable (fields))
+    return status_codes::OK;
+  if ( ! sas_allows (fields, permission)) {
+    cout << "Rejected token: no '" << permission << "' permission" << endl;
+    return status_codes::Forbidden;
+  }
+  if ( ! sas_covers (fields, uri::decode (tname), uri::decode (partition),
+                     uri::decode (row), utility::datetime::utc_now ())) {
+    cout << "Rejected token: expired or does not cover entity" << endl;
+    return status_codes::NotFound;
+  }
+  return status_codes::OK;
+}
+
 /*
   Read from a table using a security token
 
@@ -45,12 +107,16 @@ using web::http::uri;
     "http://STORAGE.table.core.windows.net/", where STORAGE is
     replaced by the user's Azure Storage account name.
 
-  Returns a pair:
+  Returns a task for a pair:
     first: HTTP status code from the read
     second: if the status code is OK, the entity read from the table
+
+  A token that check_token() rejects gets its status at once, without
+  a request to Azure. Otherwise the task completes when Azure responds;
+  no thread is blocked meanwhile.
  */
-pair<status_code,table_entity> read_with_token (const http_request& message,
-                                                 const string& endpoint) {
+pplx::task<pair<status_code,table_entity>> read_with_token_async (const http_request& message,
+                                                                  const string& endpoint) {
   /*
     Tokens can contain %2F ('/'). Thus we split the URI path
     *before* decoding and pass the undecoded values to Azure Storage
@@ -58,7 +124,7 @@ pair<status_code,table_entity> read_with_token (const http_request& message,
   const string undecoded_path {message.relative_uri().path()};
   const vector<string> undecoded_paths {uri::split_path(undecoded_path)};
   if (undecoded_paths.size () != 5) {
-    return make_pair (status_codes::BadRequest, table_entity{});
+    return pplx::task_from_result(make_pair (status_codes::BadRequest, table_entity{}));
   }
 
   const string tname {undecoded_paths[1]};
@@ -66,33 +132,38 @@ pair<status_code,table_entity> read_with_token (const http_request& message,
   const string partition {undecoded_paths[3]};
   const string row {undecoded_paths[4]};
 
-  try {
-    uri endpoint_uri {endpoint};
-    storage_credentials creds {token};
-    cloud_table_client client {endpoint_uri, creds};
+  const status_code token_status {check_token (token, tname, partition, row, 'r')};
+  if (token_status != status_codes::OK) {
+    return pplx::task_from_result(make_pair (token_status, table_entity{}));
+  }
 
+  try {
     table_operation op {table_operation::retrieve_entity(partition, row)};
-    cloud_table table_cred {client.get_table_reference(tname)};
-    table_result retrieve_result {table_cred.execute(op)};
-    if (retrieve_result.http_status_code() == status_codes::NotFound) {
-      cout << "Not found" << endl;
-      return make_pair (status_codes::NotFound,
-                         table_entity{});
-    }
+    cloud_table table_cred {token_client_pool.lookup_table(endpoint, tname, token)};
+    return table_cred.execute_async(op)
+      .then([] (pplx::task<table_result> result) -> pair<status_code,table_entity>
+            {
+              try {
+                table_result retrieve_result {result.get()};
+                if (retrieve_result.http_status_code() == status_codes::NotFound) {
+                  cout << "Not found" << endl;
+                  return make_pair (status_codes::NotFound,
+                                     table_entity{});
+                }
 
-    table_entity entity {retrieve_result.entity()};
-    return make_pair (status_codes::OK,
-                       entity);
+                table_entity entity {retrieve_result.entity()};
+                return make_pair (status_codes::OK,
+                                   entity);
+              }
+              catch (const storage_exception& e) {
+                return make_pair (storage_error_status (e),
+                                   table_entity{});
+              }
+            });
   }
   catch (const storage_exception& e) {
-    cout << "Azure Table Storage error: " << e.what() << endl;
-    cout << e.result().extended_error().message() << endl;
-    if (e.result().http_status_code() == status_codes::Forbidden)
-      return make_pair (status_codes::Forbidden,
-                         table_entity{});
-    else
-      return make_pair (status_codes::InternalError,
-                         table_entity{});
+    return pplx::task_from_result(make_pair (storage_error_status (e),
+                                             table_entity{}));
   }
 }
 
@@ -109,11 +180,21 @@ pair<status_code,table_entity> read_with_token (const http_request& message,
   props is an unordered_map of properties to be merged into
     the entity. This will typically be the result of get_json_body().
 
-  Returns:  HTTP status code from the write.
+  Returns:  a task for the HTTP status code from the write:
+    OK if the entity was updated
+    Forbidden if the token does not grant update permission, or
+      Azure rejects a token that check_token() accepted
+    NotFound if check_token() finds the token does not cover
+      the entity
+    Any other status from Azure
+
+  A token that check_token() rejects gets its status at once, without
+  a request to Azure. Otherwise the task completes when Azure responds;
+  no thread is blocked meanwhile.
  */
-status_code update_with_token (const http_request& message,
-                               const string& endpoint,
-                               const unordered_map<string,string>& props) {
+pplx::task<status_code> update_with_token_async (const http_request& message,
+                                                 const string& endpoint,
+                                                 const unordered_map<string,string>& props) {
 
   /*
     Tokens can contain %2F ('/'). Thus we split the URI path
@@ -122,40 +203,197 @@ status_code update_with_token (const http_request& message,
   const string undecoded_path {message.relative_uri().path()};
   const vector<string> undecoded_paths {uri::split_path(undecoded_path)};
   if (undecoded_paths.size () != 5) {
-    return status_codes::BadRequest;
+    return pplx::task_from_result(status_codes::BadRequest);
   }
 
   const string tname {undecoded_paths[1]};
   const string token {undecoded_paths[2]};
   const string partition {undecoded_paths[3]};
   const string row {undecoded_paths[4]};
+
+  const status_code token_status {check_token (token, tname, partition, row, 'u')};
+  if (token_status != status_codes::OK) {
+    return pplx::task_from_result(token_status);
+  }
+
   table_entity entity {partition, row};
   try {
-    uri endpoint_uri {endpoint};
-    storage_credentials creds {token};
-    cloud_table_client client {endpoint_uri, creds};
-
     table_entity::properties_type& properties = entity.properties();
-    for (const auto v : props) {
+    for (const auto& v : props) {
       properties[v.first] = entity_property {v.second};
     }
 
     table_operation op {table_operation::merge_entity(entity)};
-    cloud_table table_cred {client.get_table_reference(tname)};
-    table_result update_result {table_cred.execute(op)};
-    status_code status {static_cast<status_code> (update_result.http_status_code())};
-    if (status == status_codes::NoContent || status == status_codes::OK)
-      return status_codes::OK;
-    else
-      return status;
+    cloud_table table_cred {token_client_pool.lookup_table(endpoint, tname, token)};
+    return table_cred.execute_async(op)
+      .then([] (pplx::task<table_result> result) -> status_code
+            {
+              try {
+                table_result update_result {result.get()};
+                status_code status {static_cast<status_code> (update_result.http_status_code())};
+                if (status == status_codes::NoContent || status == status_codes::OK)
+                  return status_codes::OK;
+                else
+                  return status;
+              }
+              catch (const storage_exception& e) {
+                return storage_error_status (e);
+              }
+            });
   }
   catch (const storage_exception& e)
   {
-    cout << "Azure Table Storage error: " << e.what() << endl;
-    cout << e.result().extended_error().message() << endl;
-    if (e.result().http_status_code() == status_codes::Forbidden)
-      return status_codes::Forbidden;
-    else
-      return status_codes::InternalError;
+    return pplx::task_from_result(storage_error_status (e));
+  }
+}
+
+const char list_separator {'|'};
+
+// Attempts at a list edit before giving up to concurrent writers
+constexpr int list_edit_attempts {5};
+
+/*
+  Return list with item appended, unless it is already there, or
+  with every element equal to item removed. Empty elements, such as
+  from a leading or trailing separator, are dropped.
+ */
+static string edited_list (const string& list, const string& item, list_edit edit) {
+  string result {};
+  bool present {false};
+  string::size_type start {0};
+  while (start <= list.size()) {
+    string::size_type end {list.find (list_separator, start)};
+    if (end == string::npos)
+      end = list.size();
+    const bool matches {list.compare (start, end - start, item) == 0};
+    present = present || matches;
+    if (end > start && (edit == list_edit::append || ! matches)) {
+      if ( ! result.empty())
+        result += list_separator;
+      result.append (list, start, end - start);
+    }
+    start = end + 1;
+  }
+  if (edit == list_edit::append && ! present) {
+    if ( ! result.empty())
+      result += list_separator;
+    result += item;
+  }
+  return result;
+}
+
+/*
+  Read the entity, edit the list in prop and merge it back on
+  condition that the entity is unchanged since the read (its ETag
+  still matches). If another write got in first, Azure answers
+  PreconditionFailed and the edit starts over from a fresh read,
+  up to attempts_left times in all.
+ */
+static pplx::task<status_code> edit_list_attempt (cloud_table table,
+                                                  const string& partition,
+                                                  const string& row,
+                                                  const string& prop,
+                                                  const string& item,
+                                                  list_edit edit,
+                                                  int attempts_left) {
+  return table.execute_async(table_operation::retrieve_entity(partition, row))
+    .then([table, partition, row, prop, item, edit, attempts_left] (pplx::task<table_result> result)
+          -> pplx::task<status_code>
+          {
+            table_entity current;
+            try {
+              table_result retrieve_result {result.get()};
+              if (retrieve_result.http_status_code() == status_codes::NotFound)
+                return pplx::task_from_result(status_codes::NotFound);
+              current = retrieve_result.entity();
+            }
+            catch (const storage_exception& e) {
+              return pplx::task_from_result(storage_error_status (e));
+            }
+
+            auto found (current.properties().find(prop));
+            const string list {found == current.properties().end() ? string {} : found->second.str()};
+            const string edited {edited_list (list, item, edit)};
+            if (edited == list)
+              return pplx::task_from_result(status_codes::OK);
+
+            table_entity entity {partition, row};
+            entity.set_etag(current.etag());
+            entity.properties()[prop] = entity_property {edited};
+            return table.execute_async(table_operation::merge_entity(entity))
+              .then([table, partition, row, prop, item, edit, attempts_left] (pplx::task<table_result> result)
+                    -> pplx::task<status_code>
+                    {
+                      try {
+                        result.get();
+                        return pplx::task_from_result(status_codes::OK);
+                      }
+                      catch (const storage_exception& e) {
+                        if (e.result().http_status_code() != status_codes::PreconditionFailed)
+                          return pplx::task_from_result(storage_error_status (e));
+                      }
+                      if (attempts_left <= 1) {
+                        cout << "List edit abandoned after " << list_edit_attempts
+                             << " conflicting attempts" << endl;
+                        return pplx::task_from_result(status_codes::Conflict);
+                      }
+                      return edit_list_attempt (table, partition, row, prop, item, edit,
+                                                attempts_left - 1);
+                    });
+          });
+}
+
+/*
+  Append item to, or remove it from, the list held in property prop
+  of an entity, using a security token. The list is a string of
+  elements separated by list_separator; a missing property is an
+  empty list.
+
+  message and endpoint are as for update_with_token_async(). The
+  token must grant both read and update permission.
+
+  The edit is made in storage with a conditional merge, retried on
+  conflict, so concurrent edits of the same list are never lost.
+
+  Returns: a task for the HTTP status code of the edit:
+    OK if the list was edited, or already held the item to append
+      or lacked the item to remove
+    BadRequest if the path is malformed
+    Forbidden if the token does not grant read and update permission,
+      or Azure rejects a token that check_token() accepted
+    NotFound if the entity does not exist, or check_token() finds the
+      token does not cover it
+    Conflict if concurrent writers won every attempt
+    InternalError for any other storage error
+ */
+pplx::task<status_code> edit_list_with_token_async (const http_request& message,
+                                                    const string& endpoint,
+                                                    const string& prop,
+                                                    const string& item,
+                                                    list_edit edit) {
+  const string undecoded_path {message.relative_uri().path()};
+  const vector<string> undecoded_paths {uri::split_path(undecoded_path)};
+  if (undecoded_paths.size () != 5) {
+    return pplx::task_from_result(status_codes::BadRequest);
+  }
+
+  const string tname {undecoded_paths[1]};
+  const string token {undecoded_paths[2]};
+  const string partition {undecoded_paths[3]};
+  const string row {undecoded_paths[4]};
+
+  for (const char permission : {'r', 'u'}) {
+    const status_code token_status {check_token (token, tname, partition, row, permission)};
+    if (token_status != status_codes::OK) {
+      return pplx::task_from_result(token_status);
+    }
+  }
+
+  try {
+    cloud_table table_cred {token_client_pool.lookup_table(endpoint, tname, token)};
+    return edit_list_attempt (table_cred, partition, row, prop, item, edit, list_edit_attempts);
+  }
+  catch (const storage_exception& e) {
+    return pplx::task_from_result(storage_error_status (e));
   }
 }
@@ -0,0 +1,349 @@
+#include "../include/SessionStore.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using pplx::extensibility::scoped_critical_section_t;
+
+using std::string;
+
+using system_clock = std::chrono::system_clock;
+
+/*
+  Snapshot and log records:
+    '+' userid token partition row expiry  -- session added or replaced
+    '-' userid                             -- session removed
+  Strings are a 32-bit length followed by the bytes; expiry is a
+  64-bit count of seconds since the system_clock epoch.
+ */
+namespace {
+
+const char insert_record {'+'};
+const char erase_record {'-'};
+
+void put_string(string& out, const string& s) {
+  const std::uint32_t size {static_cast<std::uint32_t>(s.size())};
+  out.append(reinterpret_cast<const char*>(&size), sizeof size);
+  out.append(s);
+}
+
+void put_insert(string& out, const string& userid,
+                const SessionStore::session_t& session,
+                system_clock::time_point expires) {
+  const std::int64_t expiry {
+    std::chrono::duration_cast<std::chrono::seconds>(expires.time_since_epoch()).count()};
+  out.push_back(insert_record);
+  put_string(out, userid);
+  put_string(out, session.token);
+  put_string(out, session.partition);
+  put_string(out, session.row);
+  out.append(reinterpret_cast<const char*>(&expiry), sizeof expiry);
+}
+
+// Each get_ returns false, leaving pos unspecified, if in ends first
+bool get_string(const string& in, string::size_type& pos, string& s) {
+  std::uint32_t size;
+  if (in.size() - pos < sizeof size)
+    return false;
+  std::memcpy(&size, in.data() + pos, sizeof size);
+  pos += sizeof size;
+  if (in.size() - pos < size)
+    return false;
+  s.assign(in, pos, size);
+  pos += size;
+  return true;
+}
+
+bool get_int(const string& in, string::size_type& pos, std::int64_t& n) {
+  if (in.size() - pos < sizeof n)
+    return false;
+  std::memcpy(&n, in.data() + pos, sizeof n);
+  pos += sizeof n;
+  return true;
+}
+
+/*
+  Restrict the file at path to its owner (mode 0600), creating it
+  empty first if create is true. Returns false if the file could not
+  be created or restricted; a missing file that need not be created
+  is not an error.
+ */
+bool make_private(const string& path, bool create) {
+  if (create) {
+    const int fd {::open(path.c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR)};
+    if (fd < 0)
+      return false;
+    ::close(fd);
+  }
+  return ::chmod(path.c_str(), S_IRUSR | S_IWUSR) == 0 || ( ! create && errno == ENOENT);
+}
+
+/*
+  Force the file or directory at path to disk with fsync(). Returns
+  false if it could not be opened or synced.
+ */
+bool sync_path(const string& path) {
+  const int fd {::open(path.c_str(), O_RDONLY)};
+  if (fd < 0)
+    return false;
+  const bool synced {::fsync(fd) == 0};
+  ::close(fd);
+  return synced;
+}
+
+// The directory holding the file at path
+string directory_of(const string& path) {
+  const string::size_type slash {path.rfind('/')};
+  if (slash == string::npos)
+    return ".";
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+}
+
+constexpr std::size_t SessionStore::shard_count;
+constexpr std::size_t SessionStore::min_sweep_size;
+
+SessionStore::shard_t& SessionStore::shard_for(const string& userid) {
+  return shards[std::hash<string>{}(userid) % shard_count];
+}
+
+void SessionStore::insert(const string& userid,
+                          const session_t& session,
+                          store_clock::duration ttl) {
+  const store_clock::time_point now {store_clock::now()};
+  shard_t& shard (shard_for(userid));
+  scoped_critical_section_t lock {shard.lock};
+
+  if (shard.entries.size() >= shard.sweep_size) {
+    for (auto entry = shard.entries.begin(); entry != shard.entries.end(); ) {
+      if (entry->second.expires <= now)
+        entry = shard.entries.erase(entry);
+      else
+        ++entry;
+    }
+    shard.sweep_size = 2 * shard.entries.size() > min_sweep_size ?
+      2 * shard.entries.size() : min_sweep_size;
+  }
+  shard.entries[userid] = entry_t {session, now + ttl};
+
+  put_insert(shard.pending, userid, session,
+             system_clock::now() + std::chrono::duration_cast<system_clock::duration>(ttl));
+}
+
+bool SessionStore::lookup(const string& userid, session_t& session) {
+  shard_t& shard (shard_for(userid));
+  scoped_critical_section_t lock {shard.lock};
+
+  auto entry (shard.entries.find(userid));
+  if (entry == shard.entries.end())
+    return false;
+  if (entry->second.expires <= store_clock::now()) {
+    shard.entries.erase(entry);
+    return false;
+  }
+  session = entry->second.session;
+  return true;
+}
+
+bool SessionStore::erase(const string& userid) {
+  shard_t& shard (shard_for(userid));
+  scoped_critical_section_t lock {shard.lock};
+
+  auto entry (shard.entries.find(userid));
+  if (entry == shard.entries.end())
+    return false;
+  const bool live {entry->second.expires > store_clock::now()};
+  shard.entries.erase(entry);
+
+  shard.pending.push_back(erase_record);
+  put_string(shard.pending, userid);
+  return live;
+}
+
+/*
+  Move the pending records of every shard to the log. Each shard's
+  records are taken in one piece under its lock, and log_lock keeps
+  writes of successive batches in order, so the changes to any one
+  user are logged in the order they were made to the store.
+ */
+void SessionStore::write_pending() {
+  string records {};
+  for (auto& shard : shards) {
+    records.clear();
+    {
+      scoped_critical_section_t lock {shard.lock};
+      records.swap(shard.pending);
+    }
+    if (log.is_open())
+      log.write(records.data(), records.size());
+  }
+}
+
+void SessionStore::flush() {
+  scoped_critical_section_t lock {log_lock};
+  write_pending();
+  if (log.is_open())
+    log.flush();
+}
+
+/*
+  Apply the records in the file at path, stopping at the first
+  incomplete one, which a crash may have left at the end of a log.
+  Sets complete to the length of the records applied, and returns
+  their number.
+ */
+std::size_t SessionStore::replay(const string& path, std::size_t& complete) {
+  complete = 0;
+  std::ifstream in {path, std::ios::binary};
+  if ( ! in)
+    return 0;
+  in.seekg(0, std::ios::end);
+  string data (static_cast<string::size_type>(in.tellg()), '\0');
+  in.seekg(0, std::ios::beg);
+  in.read(&data[0], data.size());
+
+  const system_clock::time_point system_now {system_clock::now()};
+  const store_clock::time_point now {store_clock::now()};
+  std::size_t applied {0};
+  string::size_type pos {0};
+  string userid;
+  session_t session;
+  std::int64_t expiry;
+  while (pos < data.size()) {
+    const char kind {data[pos++]};
+    if ( ! get_string(data, pos, userid))
+      break;
+    if (kind == insert_record) {
+      if ( ! get_string(data, pos, session.token) ||
+           ! get_string(data, pos, session.partition) ||
+           ! get_string(data, pos, session.row) ||
+           ! get_int(data, pos, expiry))
+        break;
+    }
+    else if (kind != erase_record) {
+      break;
+    }
+
+    shard_t& shard (shard_for(userid));
+    scoped_critical_section_t lock {shard.lock};
+    const system_clock::time_point expires {
+      kind == insert_record ? system_clock::time_point {std::chrono::seconds {expiry}} : system_now};
+    if (expires <= system_now)
+      shard.entries.erase(userid);
+    else
+      shard.entries[userid] = entry_t {
+        std::move(session), now + std::chrono::duration_cast<store_clock::duration>(expires - system_now)};
+    ++applied;
+    complete = pos;
+  }
+  return applied;
+}
+
+/*
+  Write every unexpired session to a temporary file and rename it
+  over the snapshot, so a crash never leaves a partial snapshot. The
+  file is synced before the rename and its directory after it, so
+  this holds for a power loss too, and once this returns true the new
+  snapshot is on disk and the old log can be removed.
+
+  Shards are copied one at a time while changes continue. Every
+  change made during the copy is also in the current log, and
+  replaying it over the snapshot gives each user their latest state.
+ */
+bool SessionStore::write_snapshot() {
+  const string temp_path {snapshot_path + ".tmp"};
+  if ( ! make_private(temp_path, true))
+    return false;
+  std::ofstream out {temp_path, std::ios::binary | std::ios::trunc};
+  if ( ! out)
+    return false;
+
+  const system_clock::time_point system_now {system_clock::now()};
+  const store_clock::time_point now {store_clock::now()};
+  string records {};
+  for (auto& shard : shards) {
+    records.clear();
+    {
+      scoped_critical_section_t lock {shard.lock};
+      for (const auto& entry : shard.entries) {
+        if (entry.second.expires <= now)
+          continue;
+        put_insert(records, entry.first, entry.second.session,
+                   system_now + std::chrono::duration_cast<system_clock::duration>(
+                     entry.second.expires - now));
+      }
+    }
+    out.write(records.data(), records.size());
+  }
+  out.close();
+  if ( ! out || ! sync_path(temp_path))
+    return false;
+  return std::rename(temp_path.c_str(), snapshot_path.c_str()) == 0 &&
+    sync_path(directory_of(snapshot_path));
+}
+
+bool SessionStore::open(const string& path, std::size_t& loaded) {
+  snapshot_path = path;
+  const string log_path {snapshot_path + ".log"};
+  const string old_log_path {log_path + ".old"};
+
+  // A log.old is left only by a snapshot that did not complete, so
+  // its changes come after the snapshot and before the log
+  std::size_t complete {0};
+  replay(snapshot_path, complete);
+  replay(old_log_path, complete);
+  replay(log_path, complete);
+
+  loaded = 0;
+  for (auto& shard : shards) {
+    scoped_critical_section_t lock {shard.lock};
+    loaded += shard.entries.size();
+  }
+
+  // New records must never follow one torn by a crash, so cut any
+  // incomplete record off the end of the log before appending to it.
+  // Nothing is appended to log.old, which the next snapshot removes.
+  bool ready {make_private(snapshot_path, false) &&
+              make_private(old_log_path, false) &&
+              make_private(log_path, true) &&
+              ::truncate(log_path.c_str(), static_cast<off_t>(complete)) == 0};
+  scoped_critical_section_t lock {log_lock};
+  if (ready)
+    log.open(log_path, std::ios::binary | std::ios::app);
+  return ready && log.is_open();
+}
+
+bool SessionStore::snapshot() {
+  const string log_path {snapshot_path + ".log"};
+  const string old_log_path {log_path + ".old"};
+  {
+    scoped_critical_section_t lock {log_lock};
+    if ( ! log.is_open())
+      return false;
+    write_pending();
+    log.close();
+    // If an earlier snapshot failed, log.old still holds changes it
+    // did not capture; leave both logs in place for this one to cover
+    if ( ! std::ifstream {old_log_path})
+      std::rename(log_path.c_str(), old_log_path.c_str());
+    make_private(log_path, true);
+    log.open(log_path, std::ios::binary | std::ios::app);
+  }
+
+  if ( ! write_snapshot())
+    return false;
+  std::remove(old_log_path.c_str());
+  return true;
+}
@@ -0,0 +1,27 @@
+#include "../include/Settings.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+
+using std::string;
+
+std::size_t env_size (const char* name, std::size_t default_value) {
+  const char* text {std::getenv(name)};
+  if (text == nullptr)
+    return default_value;
+
+  const string digits {text};
+  // At most 18 digits, so the value cannot overflow
+  if (digits.empty() || digits.size() > 18 ||
+      digits.find_first_not_of("0123456789") != string::npos)
+    return default_value;
+  return static_cast<std::size_t>(std::stoull(digits));
+}
+
+std::chrono::seconds env_seconds (const char* name, std::chrono::seconds default_value) {
+  return std::chrono::seconds {
+    static_cast<std::chrono::seconds::rep>(env_size(name, static_cast<std::size_t>(default_value.count())))
+  };
+}
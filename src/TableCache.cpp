@@ -1,8 +1,15 @@
 #include "../include/TableCache.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <was/storage_account.h>
 #include <was/table.h>
@@ -10,33 +17,327 @@
 using azure::storage::cloud_storage_account;
 using azure::storage::cloud_table;
 using azure::storage::cloud_table_client;
+using azure::storage::continuation_token;
+using azure::storage::storage_exception;
 using azure::storage::storage_uri;
+using azure::storage::table_result_segment;
 
 using pplx::extensibility::critical_section_t;
 using pplx::extensibility::scoped_critical_section_t;
 
+using std::cout;
+using std::endl;
 using std::string;
+using std::vector;
+
+using std::chrono::steady_clock;
 
 using web::http::uri;
 
-using cache_t = std::unordered_map<string,cloud_table>;
+std::atomic<unsigned long long> TableCache::next_id {0};
+
+/*
+  Return the entry for a table, adding one that is not known to exist
+  if there is none. added is set to whether an entry was added.
+
+  Caller must hold resplock, and must publish() once it has made all
+  its changes, including any addition.
+ */
+TableCache::entry_t& TableCache::find_or_add(const string& table_name, bool& added) {
+  auto entry (table_cache.find(table_name));
+  added = entry == table_cache.end();
+  if (added) {
+    entry = table_cache.emplace(table_name, entry_t {}).first;
+    entry->second.table = client.get_table_reference(table_name);
+  }
+  return entry->second;
+}
+
+/*
+  Make the current state of table_cache visible to lock-free readers.
+
+  Caller must hold resplock, so snapshots are published in order. The
+  version is bumped after the copy is in place, so a reader that sees
+  the new version and takes resplock finds a copy at least as new.
+ */
+void TableCache::publish() {
+  snapshot = std::make_shared<const snapshot_t>(table_cache);
+  version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/*
+  Return the latest published copy of table_cache, for reading without
+  resplock.
+
+  Each thread holds a reference to the copy it last read from each
+  cache, with the version it was read at. While the version has not
+  changed, the held copy is returned without locking or touching its
+  reference count. The result stays valid until the same thread next
+  calls current() on this cache.
+
+  Must not be called with resplock held.
+ */
+const TableCache::snapshot_t& TableCache::current() {
+  struct reader_t {
+    unsigned long long cache_id;
+    unsigned long long version;
+    std::shared_ptr<const snapshot_t> snapshot;
+  };
+  // Almost always one entry per cache in the process, so a linear
+  // search is cheapest
+  static thread_local vector<reader_t> readers {};
+
+  const unsigned long long latest {version.load(std::memory_order_acquire)};
+  auto reader (std::find_if(readers.begin(), readers.end(),
+                            [this] (const reader_t& r) { return r.cache_id == id; }));
+  if (reader != readers.end() && reader->version == latest)
+    return *reader->snapshot;
+
+  scoped_critical_section_t lock {resplock};
+  if (reader == readers.end()) {
+    readers.push_back(reader_t {id, 0, nullptr});
+    reader = readers.end() - 1;
+  }
+  reader->snapshot = snapshot;
+  reader->version = version.load(std::memory_order_relaxed);
+  return *reader->snapshot;
+}
+
+/*
+  Start a background check of whether an existing table still exists.
+
+  Caller must hold resplock. The entry is published as rechecking, so
+  lock-free readers keep the cached answer until the check completes
+  rather than each taking the lock. The entry is looked up again when
+  the check completes, as it may have been deleted in the meantime.
+ */
+void TableCache::recheck(const string& table_name, entry_t& entry) {
+  entry.rechecking = true;
+  publish();
+  const unsigned long long started_deletions {deletions};
+  entry.table.exists_async()
+    .then([this, table_name, started_deletions] (pplx::task<bool> result)
+          {
+            bool exists {true};
+            try {
+              exists = result.get();
+            }
+            catch (const std::exception& e) {
+              // Keep the last known state and try again next interval
+              cout << "Table recheck of " << table_name << " failed: " << e.what() << endl;
+            }
+            scoped_critical_section_t lock {resplock};
+            auto entry (table_cache.find(table_name));
+            if (entry == table_cache.end())
+              return;
+            entry->second.rechecking = false;
+            if (started_deletions == deletions) {
+              entry->second.exists = exists;
+              entry->second.checked = steady_clock::now();
+            }
+            publish();
+          });
+}
 
 cloud_table TableCache::lookup_table(const string& table_name) {
   assert (client.base_uri ().path() != "");
+  {
+    const snapshot_t& tables (current());
+    auto entry (tables.find(table_name));
+    if (entry != tables.end())
+      return entry->second.table;
+  }
+
   scoped_critical_section_t lock {resplock};
+  bool added {};
+  cloud_table table {find_or_add(table_name, added).table};
+  if (added)
+    publish();
+  return table;
+}
 
-  auto entry (table_cache.find(table_name));
-  if (entry == table_cache.end()) {
-      cloud_table table {client.get_table_reference(table_name)};
-      table_cache[table_name] = table;
-      return table;
+/*
+  Return a task for whether the table exists.
+
+  A table already known to exist costs no storage call, and the task
+  is already complete; while it is being rechecked, the cached answer
+  is returned without taking the lock. Otherwise Azure is asked,
+  without blocking, and a positive answer is remembered.
+ */
+pplx::task<bool> TableCache::table_exists_async(const string& table_name) {
+  assert (client.base_uri ().path() != "");
+  {
+    // Known to exist and not due for a recheck, or with a recheck
+    // already under way: no lock needed
+    const snapshot_t& tables (current());
+    auto entry (tables.find(table_name));
+    if (entry != tables.end() && entry->second.exists &&
+        (recheck_interval == steady_clock::duration::zero() ||
+         entry->second.rechecking ||
+         steady_clock::now() - entry->second.checked < recheck_interval))
+      return pplx::task_from_result(true);
   }
-  return entry->second;
+
+  cloud_table table {};
+  unsigned long long started_deletions {};
+  {
+    scoped_critical_section_t lock {resplock};
+    bool added {};
+    entry_t& entry (find_or_add(table_name, added));
+    if (added)
+      publish();
+    if (entry.exists) {
+      if (recheck_interval != steady_clock::duration::zero() &&
+          ! entry.rechecking &&
+          steady_clock::now() - entry.checked >= recheck_interval) {
+        recheck(table_name, entry);
+      }
+      return pplx::task_from_result(true);
+    }
+    table = entry.table;
+    started_deletions = deletions;
+  }
+
+  // Not known to exist, so ask Azure without holding the lock
+  return table.exists_async()
+    .then([this, table_name, started_deletions] (bool exists)
+          {
+            if (exists) {
+              scoped_critical_section_t lock {resplock};
+              // A delete_entry() during the check makes the answer stale
+              if (started_deletions == deletions) {
+                bool added {};
+                entry_t& entry (find_or_add(table_name, added));
+                entry.exists = true;
+                entry.checked = steady_clock::now();
+                publish();
+              }
+            }
+            return exists;
+          });
+}
+
+/*
+  As table_exists_async(), but blocking until Azure answers if the
+  table is not already known to exist
+ */
+bool TableCache::table_exists(const string& table_name) {
+  return table_exists_async(table_name).get();
+}
+
+/*
+  Create the table if it does not already exist.
+
+  Returns a task for true if the table was created, false if it
+  already existed. No thread is blocked while Azure creates it.
+ */
+pplx::task<bool> TableCache::create_table_async(const string& table_name) {
+  cloud_table table {lookup_table(table_name)};
+  return table.create_if_not_exists_async()
+    .then([this, table_name] (bool created)
+          {
+            scoped_critical_section_t lock {resplock};
+            bool added {};
+            entry_t& entry (find_or_add(table_name, added));
+            entry.exists = true;
+            entry.checked = steady_clock::now();
+            publish();
+            return created;
+          });
 }
 
+/*
+  Forget a table, typically after it has been deleted.
+
+  Returns true if the table was in the cache.
+ */
 bool TableCache::delete_entry(const string& table_name) {
   scoped_critical_section_t lock {resplock};
 
-  cache_t::size_type count {table_cache.erase(table_name)};
+  ++deletions;
+  auto count (table_cache.erase(table_name));
+  if (count == 1)
+    publish();
   return count == 1;
 }
+
+/*
+  Fill the cache before serving requests.
+
+  Every table is looked up and its existence checked, all checks in
+  parallel. The checks also open the connections to Azure, so the
+  first requests do not pay for connection setup.
+
+  Returns the number of tables found to exist. A failed check is
+  logged, and the table is checked again on first use.
+
+  The cache is published once for each pass over the tables, not once
+  per table, so warming up n tables copies the cache twice rather than
+  n times.
+ */
+std::size_t TableCache::warm_up(const vector<string>& table_names) {
+  assert (client.base_uri ().path() != "");
+  vector<pplx::task<bool>> checks {};
+  unsigned long long started_deletions {};
+  {
+    scoped_critical_section_t lock {resplock};
+    started_deletions = deletions;
+    bool added {};
+    bool any_added {false};
+    for (const auto& table_name : table_names) {
+      checks.push_back(find_or_add(table_name, added).table.exists_async());
+      any_added = any_added || added;
+    }
+    if (any_added)
+      publish();
+  }
+
+  vector<bool> exists (table_names.size(), false);
+  for (vector<bool>::size_type i {0}; i < checks.size(); ++i) {
+    try {
+      exists[i] = checks[i].get();
+    }
+    catch (const std::exception& e) {
+      cout << "Warm-up check of " << table_names[i] << " failed: " << e.what() << endl;
+    }
+  }
+
+  std::size_t found {0};
+  scoped_critical_section_t lock {resplock};
+  // A delete_entry() during the checks makes the answers stale
+  if (started_deletions != deletions)
+    return found;
+  bool added {};
+  for (vector<bool>::size_type i {0}; i < exists.size(); ++i) {
+    if (exists[i]) {
+      entry_t& entry (find_or_add(table_names[i], added));
+      entry.exists = true;
+      entry.checked = steady_clock::now();
+      ++found;
+    }
+  }
+  publish();
+  return found;
+}
+
+/*
+  As warm_up(), for every table in the storage account.
+ */
+std::size_t TableCache::warm_up_all() {
+  assert (client.base_uri ().path() != "");
+  vector<string> table_names {};
+  try {
+    continuation_token token {};
+    do {
+      table_result_segment segment {client.list_tables_segmented(token)};
+      for (const auto& table : segment.results())
+        table_names.push_back(table.name());
+      token = segment.continuation_token();
+    } while (!token.empty());
+  }
+  catch (const storage_exception& e) {
+    cout << "Azure Table Storage error: " << e.what() << endl;
+    return 0;
+  }
+  return warm_up(table_names);
+}
@@ -0,0 +1,63 @@
+#include "../include/TokenClientPool.h"
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include <cpprest/asyncrt_utils.h>
+#include <cpprest/base_uri.h>
+
+#include <was/table.h>
+
+#include "../include/SasToken.h"
+
+using azure::storage::cloud_table;
+using azure::storage::cloud_table_client;
+using azure::storage::storage_credentials;
+
+using pplx::extensibility::scoped_critical_section_t;
+
+using std::string;
+
+using web::http::uri;
+
+// Caller must hold lock
+void TokenClientPool::erase(std::unordered_map<string,entry_t>::iterator entry) {
+  lru.erase(entry->second.position);
+  entries.erase(entry);
+}
+
+cloud_table TokenClientPool::lookup_table(const string& endpoint,
+                                          const string& table_name,
+                                          const string& token) {
+  const string key {endpoint + ' ' + table_name + ' ' + token};
+  {
+    scoped_critical_section_t l {lock};
+    auto entry (entries.find(key));
+    if (entry != entries.end()) {
+      if (entry->second.expires > pool_clock::now()) {
+        ++hit_count;
+        lru.splice(lru.begin(), lru, entry->second.position);
+        return entry->second.table;
+      }
+      erase(entry);
+    }
+  }
+
+  // Build outside the lock; a concurrent miss on the same key
+  // just replaces this entry
+  ++miss_count;
+  cloud_table_client client {uri {endpoint}, storage_credentials {token}};
+  cloud_table table {client.get_table_reference(table_name)};
+  const pool_clock::time_point expires {pool_clock::now() + sas_lifetime(token, fallback_ttl)};
+
+  scoped_critical_section_t l {lock};
+  auto entry (entries.find(key));
+  if (entry != entries.end())
+    erase(entry);
+  while (entries.size() >= capacity)
+    erase(entries.find(lru.back()));
+  lru.push_front(key);
+  entries.emplace(key, entry_t {table, expires, lru.begin()});
+  return table;
+}
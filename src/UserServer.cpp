@@ -12,10 +12,15 @@
   http://localhost:34572.
 */
 
+#include <chrono>
+#include <condition_variable>
 #include <exception>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -32,8 +37,14 @@
 #include <was/table.h>
 
 #include "../include/ClientUtils.h"
+#include "../include/FriendSet.h"
+#include "../include/JsonBody.h"
+#include "../include/Router.h"
+#include "../include/SasToken.h"
 #include "../include/ServerUrls.h"
 #include "../include/ServerUtils.h"
+#include "../include/Services.h"
+#include "../include/SessionStore.h"
 
 #include "../include/azure_keys.h"
 
@@ -63,7 +74,6 @@ using std::pair;
 using std::string;
 using std::unordered_map;
 using std::vector;
-using std::get;
 
 using web::http::client::http_client;
 using web::http::http_headers;
@@ -81,10 +91,14 @@ using web::http::experimental::listener::http_listener;
 
 using prop_vals_t = vector<pair<string,value>>;
 
+namespace user_service {
+
 const string get_update_data_op {"GetUpdateData"};
 
 const string read_entity_auth_op {"ReadEntityAuth"};
 const string update_entity_auth_op {"UpdateEntityAuth"};
+const string append_list_item_auth_op {"AppendListItemAuth"};
+const string remove_list_item_auth_op {"RemoveListItemAuth"};
 
 const string auth_table_partition {"Userid"};
 const string data_table {"DataTable"};
@@ -99,117 +113,90 @@ const string push_status {"PushStatus"}; //Post
 
 const string get_friend_list {"ReadFriendList"}; //GET
 
-// Cache of active sessions
-std::unordered_map< string, std::tuple<string/*token*/, string/*partition*/, string/*row*/> > sessions;
-
 /*
-  Return true if an HTTP request has a JSON body
-
-  This routine can be called multiple times on the same message.
+  Active sessions. A session lasts as long as its token, or
+  session_fallback_ttl if the token has no readable expiry.
  */
-bool has_json_body (http_request message) {
-  return message.headers()["Content-type"] == "application/json";
-}
+constexpr std::chrono::hours session_fallback_ttl {1};
+SessionStore sessions {};
 
 /*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-  get_json_body and get_json_bourne are valid and identical function calls.
+  Sessions are saved in session_snapshot_path (or the file named by
+  the first argument) so that they survive a restart. The files hold
+  users' tokens, so only the server's user may read them. Changes are
+  flushed to the log every session_flush_interval and compacted into
+  a snapshot every session_snapshot_interval.
+ */
+const string session_snapshot_path {"UserServer.sessions"};
+constexpr std::chrono::seconds session_flush_interval {1};
+constexpr std::chrono::minutes session_snapshot_interval {5};
 
-  If the message has no JSON body, return an empty map.
+// The thread that persists sessions, and how stop() ends it
+std::thread persist {};
+std::mutex persist_mutex {};
+std::condition_variable persist_stop {};
+bool stopping {false};
 
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
+/*
+  Look up the session of a signed-on user.
 
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
+  If the user is not signed on, reply Forbidden and return false.
  */
-unordered_map<string,string> get_json_body(http_request message) {
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
-
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-          {
-            json = v;
-            return true;
-          })
-    .wait();
-
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-        results[v.first] = v.second.as_string();
-      }
-      else {
-        results[v.first] = v.second.serialize();
-      }
-    }
+bool find_session (http_request message, const string& userid,
+                   string& token, string& partition, string& row) {
+  SessionStore::session_t session;
+  if(!sessions.lookup(userid, session)) {
+    message.reply(status_codes::Forbidden);
+    return false;
   }
-  return results;
-}
-
-unordered_map<string,string> get_json_bourne(http_request message) {
- return get_json_body(message);
+  token = session.token;
+  partition = session.partition;
+  row = session.row;
+  return true;
 }
 
-void handle_post (http_request message){
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
-  auto paths = uri::split_path(path);
+/*
+  Top-level routines for processing HTTP POST requests (SignOn, SignOff),
+  dispatched by operation name through the POST router set up in main().
+ */
+void handle_sign_on (http_request message, const vector<string>& paths){
+  const string userid = paths[1];
 
-  // Operation name and user ID
-  if(paths.size() < 2) {
+  if(!has_json_body(message)) {
     message.reply(status_codes::BadRequest);
     return;
   }
-  else if(paths[0] != sign_on && paths[0] != sign_off) {
+
+  unordered_map<string, string> json_body {get_json_bourne(message)};
+  if(json_body.size() != 1) {
     message.reply(status_codes::BadRequest);
+    return;
   }
 
-  const string operation = paths[0];
-  const string userid = paths[1];
-
-  if(operation == sign_on) {
-    if(!has_json_body(message)) {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-
-    unordered_map<string, string> json_body {get_json_bourne(message)};
-    if(json_body.size() != 1) {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
+  unordered_map<string, string>::const_iterator json_body_password_iterator {json_body.find("Password")};
+  // No 'Password' property
+  if(json_body_password_iterator == json_body.end()) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
 
-    unordered_map<string, string>::const_iterator json_body_password_iterator {json_body.find("Password")};
-    // No 'Password' property
-    if(json_body_password_iterator == json_body.end()) {
-      message.reply(status_codes::BadRequest);
+  vector<pair<string, value>> json_pw;
+  json_pw.push_back(make_pair(
+      json_body_password_iterator->first,
+      value::string(json_body_password_iterator->second)
+  ));
+
+  do_request_async(
+    methods::GET,
+    string(server_urls::auth_server) + "/" +
+    get_update_data_op + "/" +
+    userid,
+    value::object(json_pw)
+  ).then([message, userid] (pplx::task<req_res_t> request) {
+    req_res_t result;
+    if(!get_request_result(request, message, result)) {
       return;
     }
-
-    vector<pair<string, value>> json_pw;
-    json_pw.push_back(make_pair(
-        json_body_password_iterator->first,
-        value::string(json_body_password_iterator->second)
-    ));
-
-    pair<status_code, value> result;
-    result = do_request(
-      methods::GET,
-      string(server_urls::auth_server) + "/" +
-      get_update_data_op + "/" +
-      userid,
-      value::object(json_pw)
-    );
     if(result.first != status_codes::OK) {
       message.reply(result.first);
       return;
@@ -238,271 +225,240 @@ void handle_post (http_request message){
       return;
     }
 
-    std::tuple<string, string, string> tuple_insert(
-      token,
-      data_partition,
-      data_row);
-    std::pair<string, std::tuple<string, string, string>> pair_insert(
-      userid,
-      tuple_insert
-    );
-    sessions.insert(pair_insert);
+    sessions.insert(userid,
+                    SessionStore::session_t {token, data_partition, data_row},
+                    sas_lifetime(token, session_fallback_ttl));
 
     message.reply(status_codes::OK);
-    return;
-  }
+  });
+}
 
-  else if(operation == sign_off) {
-    auto session = sessions.find(userid);
-    if(session == sessions.end()) {
-      message.reply(status_codes::NotFound);
-      return;
-    }
+void handle_sign_off (http_request message, const vector<string>& paths){
+  const string userid = paths[1];
 
-    sessions.erase(session);
-    message.reply(status_codes::OK);
+  if(!sessions.erase(userid)) {
+    message.reply(status_codes::NotFound);
     return;
   }
+  message.reply(status_codes::OK);
+}
 
-  else {
-    message.reply(status_codes::InternalError);
+/*
+  Add the friend named by paths[2] (country) and paths[3] (name) to
+  the friends list of user paths[1], or remove them from it, with a
+  single BasicServer operation that edits the list in place.
+ */
+void edit_friends_list (http_request message, const vector<string>& paths,
+                        const string& list_op) {
+  string user_token, user_partition, user_row;
+  if (!find_session(message, paths[1], user_token, user_partition, user_row))
     return;
-  }
-}
 
-void handle_put (http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
-  auto paths = uri::split_path(path);
+  const string item {paths[2] + pair_delimiter + paths[3]};
+  do_request_async(
+    methods::PUT,
+    string(server_urls::basic_server) + "/" +
+    list_op + "/" +
+    data_table + "/" +
+    user_token + "/" +
+    user_partition + "/" +
+    user_row,
+    build_json_value("Friends", item)
+    ).then([message] (pplx::task<req_res_t> request) {
+      req_res_t result;
+      if (get_request_result(request, message, result))
+        message.reply(result.first);
+    });
+}
 
-  if (paths.size() != 2 || paths.size() != 4)
-  {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  string user_id {paths[1]};
-  if (sessions[user_id] == sessions["empty value"])
-  {
-    message.reply(status_codes::Forbidden);
-    return;
-  }
-  pair<status_code, value> result;
-  string user_token {get<0>(sessions[user_id])};
-  string user_partition {get<1>(sessions[user_id])};
-  string user_row {get<2>(sessions[user_id])};
-
-  if (paths[0] == add_friend) {
-    // TODO: Check validity of the request
-      // Invalid path size
-    if (paths.size() != 4)
-    {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-    // Get current friends list
-    result = do_request(
-      methods::GET,
-      string(server_urls::basic_server) + "/" +
-      read_entity_auth_op + "/" +
-      data_table + "/" +
-      user_token + "/" +
-      user_partition + "/" +
-      user_row
-      );
-    if (result.first != status_codes::OK)
-    {
-      message.reply(result.first);
-      return;
-    }
-    // TODO: Check status code
-    // Parse JSON body
-    unordered_map<string,string> json_body = unpack_json_object(result.second);
-    friends_list_t user_friends = parse_friends_list(json_body["Friends"]);
-    // Add new friend to list
-    user_friends.push_back(make_pair(paths[2],paths[3]));
-    // Rebuild json body
-    string user_friends_string = friends_list_to_string(user_friends);
-    result.second = build_json_value("Friends", user_friends_string);
-    // Put new friends list
-    result = do_request(
-      methods::PUT,
-      string(server_urls::basic_server) + "/" +
-      update_entity_auth_op + "/" +
-      data_table + "/" +
-      user_token + "/" +
-      user_partition + "/" +
-      user_row,
-      result.second
-      );
-    if (result.first != status_codes::OK)
-    {
-      message.reply(result.first);
-      return;
-    }
-    // TODO: Check return results
-    message.reply(status_codes::OK);
-    return;
-  }
-  /*
-   * UnFriend
-   */
-  else if (paths[0] == unfriend) {
-    // TODO: Check validity of request
-    if (paths.size() != 4)
-    {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-    // Get current friends list
-    result = do_request(
-      methods::GET,
-      string(server_urls::basic_server) + "/" +
-      read_entity_auth_op + "/" +
-      data_table + "/" +
-      user_token + "/" +
-      user_partition + "/" +
-      user_row
-      );
-    if (result.first != status_codes::OK)
-    {
-      message.reply(result.first);
-      return;
-    }
-    // TODO: Check status code
-    // Parse Json body
-    unordered_map<string,string> json_body = unpack_json_object(result.second);
-    friends_list_t user_friends = parse_friends_list(json_body["Friends"]);
-    // Remove friend from list
-    friends_list_t new_user_friends;
-    for (int i = 0; i < user_friends.size(); ++i)
-    {
-      if (user_friends[i].first != paths[2] || user_friends[i].second != paths[3])
-      {
-        new_user_friends.push_back(user_friends[i]);
-      }
-    }
-    // Rebuild json body
-    string user_friends_string = friends_list_to_string(new_user_friends);
-    result.second = build_json_value("Friends", user_friends_string);
-    // Put new friends list
-    result = do_request(
-      methods::PUT,
-      string(server_urls::basic_server) + "/" +
-      update_entity_auth_op + "/" +
-      data_table + "/" +
-      user_token + "/" +
-      user_partition + "/" +
-      user_row,
-      result.second
-      );
-    if (result.first != status_codes::OK)
-    {
-      message.reply(result.first);
-      return;
-    }
-    // TODO: Check return results
-    message.reply(status_codes::OK);
-    return; 
-  }
-  else if (paths[0] == update_status)
-  {
-    // Check validity of request
-    if (paths.size() != 3)
-    {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-    result.second = build_json_value("Status", string(paths[2]));
-    // Edit entity
-    result = do_request(
-      methods::PUT,
-      string(server_urls::basic_server) + "/" +
-      update_entity_auth_op + "/" +
-      data_table + "/" +
-      user_partition + "/" +
-      user_row,
-      result.second
-      );
-    if (result.first != status_codes::OK)
-    {
-      message.reply(result.first);
-      return;
-    }
-    // Call Pushserver
-    result = do_request(
-      methods::POST,
-      string(server_urls::push_server) + "/" +
-      push_status + "/" +
-      user_partition + "/" +
-      user_row + "/" +
-      paths[3]
-      );
-    if (result.first != status_codes::OK)
-    {
-      message.reply(result.first);
-      return;
-    }
-  }
-  else {
-    // malformed request
-    vector<value> vec;
-    message.reply(status_codes::BadRequest, value::array(vec));
-    return;
-  }
+/*
+  Top-level routines for processing HTTP PUT requests (AddFriend,
+  UnFriend, UpdateStatus), dispatched by operation name through the
+  PUT router set up in main(). The router has already checked the
+  number of path segments.
+ */
+void handle_add_friend (http_request message, const vector<string>& paths) {
+  edit_friends_list(message, paths, append_list_item_auth_op);
 }
 
-void handle_get (http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** GET " << path << endl;
-  auto paths = uri::split_path(path);
+void handle_unfriend (http_request message, const vector<string>& paths) {
+  edit_friends_list(message, paths, remove_list_item_auth_op);
+}
 
-  if (paths.size() != 2) {
-    // malformed request
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-  else if (paths[0] != get_friend_list) {
-    // malformed request
-    message.reply(status_codes::BadRequest);
+/*
+  UpdateStatus writes the status to the user's entity and pushes it
+  to their friends. The write and the read of the friends list do
+  not depend on each other, so they are made together; the push
+  follows once both have succeeded.
+ */
+void handle_update_status (http_request message, const vector<string>& paths) {
+  string user_token, user_partition, user_row;
+  if (!find_session(message, paths[1], user_token, user_partition, user_row))
     return;
-  }
 
+  const string entity_path {
+    data_table + "/" +
+    user_token + "/" +
+    user_partition + "/" +
+    user_row};
+  const string status {paths[2]};
+  pplx::task<req_res_t> update {do_request_async(
+    methods::PUT,
+    string(server_urls::basic_server) + "/" +
+    update_entity_auth_op + "/" +
+    entity_path,
+    build_json_value("Status", status)
+    )};
+  pplx::task<req_res_t> read {do_request_async(
+    methods::GET,
+    string(server_urls::basic_server) + "/" +
+    read_entity_auth_op + "/" +
+    entity_path
+    )};
+
+  then_if_ok(when_all_ok(vector<pplx::task<req_res_t>> {update, read}),
+             [read, user_partition, user_row, status] (const req_res_t&) -> pplx::task<req_res_t> {
+               const string friends {get_json_object_prop(read.get().second, "Friends")};
+               // PushServer requires someone to push to
+               if (FriendSet {friends}.empty())
+                 return pplx::task_from_result(make_pair(static_cast<status_code>(status_codes::OK),
+                                                         value::object()));
+               return do_request_async(
+                 methods::POST,
+                 string(server_urls::push_server) + "/" +
+                 push_status + "/" +
+                 user_partition + "/" +
+                 user_row + "/" +
+                 status,
+                 build_json_value("Friends", friends)
+                 );
+             })
+    .then([message] (pplx::task<req_res_t> request) {
+      req_res_t result;
+      if (get_request_result(request, message, result))
+        message.reply(result.first);
+    });
+}
+
+/*
+  Top-level routine for processing HTTP GET requests (ReadFriendList),
+  dispatched through the GET router set up in main().
+ */
+void handle_read_friend_list (http_request message, const vector<string>& paths) {
   const string userid = paths[1]; // obtains userid (parameter)
 
   // user not signed in -- The auth server does not return a token and the expected record doesn't exist in DataTable
-  auto found = sessions.find(userid);
-  if(found == sessions.end()) {
-    message.reply(status_codes::Forbidden);
+  string token, partition, row;
+  if (!find_session(message, userid, token, partition, row))
     return;
-  }
   const string table = "DataTable";
   const string operation = "ReadEntityAuth";
-  const string token = std::get<0>(found->second);
-  const string partition = std::get<1>(found->second);
-  const string row = std::get<2>(found->second);
-
-  pair<status_code,value> result = do_request (methods::GET,
-                                               server_urls::basic_server + operation + "/" + table + "/" + token + "/" + partition + "/" + row );
-
-  unordered_map<string,string> json_body = unpack_json_object(result.second);
-  friends_list_t user_friends = parse_friends_list(json_body["Friends"]);
-  vector<value> vec;
-  string user_friends_string = friends_list_to_string(user_friends);
-  result.second = build_json_value("Friends", user_friends_string);
-  vec.push_back(result.second);
-
-  message.reply(status_codes::OK, value::array(vec));
-  return;
+
+  do_request_async (methods::GET,
+                    string(server_urls::basic_server) + "/" + operation + "/" + table + "/" + token + "/" + partition + "/" + row )
+    .then([message] (pplx::task<req_res_t> request) {
+      req_res_t result;
+      if (!get_request_result(request, message, result))
+        return;
+      if (result.first != status_codes::OK) {
+        message.reply(result.first);
+        return;
+      }
+
+      unordered_map<string,string> json_body = unpack_json_object(result.second);
+      // Lists written before AddFriend dropped duplicates may still hold some
+      FriendSet user_friends {};
+      try {
+        user_friends = FriendSet {json_body["Friends"]};
+      }
+      catch (const std::invalid_argument& e) {
+        cout << e.what() << endl;
+        message.reply(status_codes::InternalError);
+        return;
+      }
+      vector<value> vec;
+      vec.push_back(build_json_value("Friends", user_friends.to_string()));
+
+      message.reply(status_codes::OK, value::array(vec));
+    });
+}
+
+
+/*
+  Start the user server
+
+  Load the saved sessions, start the thread that persists them, and
+  register the handler for each operation, with the number of path
+  segments it takes, in service.
+
+  args: [optional] the file to save sessions in, instead of
+  session_snapshot_path
+ */
+void start (Service& service, const vector<string>& args) {
+  const auto started = std::chrono::steady_clock::now();
+  const string snapshot_path {args.empty() ? session_snapshot_path : args[0]};
+  std::size_t loaded {0};
+  if ( ! sessions.open(snapshot_path, loaded))
+    cout << "Cannot write " << snapshot_path << ".log: sessions will not be saved,"
+         << " neither changes nor snapshots, until the server is restarted" << endl;
+  cout << "Loaded " << loaded << " sessions from " << snapshot_path << " in "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()
+       << " ms" << endl;
+
+  persist = std::thread {[] {
+      auto next_snapshot = std::chrono::steady_clock::now() + session_snapshot_interval;
+      std::unique_lock<std::mutex> lock {persist_mutex};
+      while ( ! persist_stop.wait_for(lock, session_flush_interval, [] { return stopping; })) {
+        sessions.flush();
+        if (std::chrono::steady_clock::now() >= next_snapshot) {
+          if ( ! sessions.snapshot())
+            cout << "Session snapshot failed" << endl;
+          next_snapshot = std::chrono::steady_clock::now() + session_snapshot_interval;
+        }
+      }
+    }};
+
+  Router& get_routes (service.routes(methods::GET)); // Get user's friend list
+  get_routes.add(get_friend_list, 2, &handle_read_friend_list);
+
+  Router& post_routes (service.routes(methods::POST)); // SignOn, SignOff
+  post_routes.add(sign_on, 2, &handle_sign_on);
+  post_routes.add(sign_off, 2, &handle_sign_off);
+
+  Router& put_routes (service.routes(methods::PUT)); // Add friend, Unfriend, Update Status
+  put_routes.add(add_friend, 4, &handle_add_friend);
+  put_routes.add(unfriend, 4, &handle_unfriend);
+  put_routes.add(update_status, 3, &handle_update_status);
+}
+
+/*
+  Stop persisting sessions once the listener has closed, saving a
+  final snapshot
+ */
+void stop () {
+  {
+    std::lock_guard<std::mutex> lock {persist_mutex};
+    stopping = true;
+  }
+  persist_stop.notify_one();
+  persist.join();
+  if ( ! sessions.snapshot())
+    cout << "Session snapshot failed" << endl;
 }
 
+}
 
+#ifndef COMBINED_SERVERS
+/*
+  Usage: userserver [SESSION_FILE]
+ */
 int main (int argc, char const * argv[]) {
+  Service service {};
+  user_service::start(service, vector<string> (argv + 1, argv + argc));
+
   cout << "Opening listener" << endl;
   http_listener listener {server_urls::user_server};
-  listener.support(methods::GET, &handle_get); // Get user's friend list
-  listener.support(methods::POST, &handle_post); // SignOn, SignOff
-  listener.support(methods::PUT, &handle_put); // Add friend, Unfriend, Update Status
-  /*TO DO: Disallowed method*/
+  service.support(listener);
   listener.open().wait(); // Wait for listener to complete starting
 
   cout << "Enter carriage return to stop server." << endl;
@@ -511,5 +467,9 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  user_service::stop();
+  cout << "HTTP client pool hits " << http_client_pool.hits()
+       << ", misses " << http_client_pool.misses() << endl;
   cout << "Closed" << endl;
 }
+#endif